@@ -9,6 +9,12 @@ cat(int fd)
 {
   int n;
 
+  // Let the kernel move the data; fall back to
+  // copying through buf if it can't.
+  while((n = splice(fd, 1, 64*1024)) > 0)
+    ;
+  if(n == 0)
+    return;
   while((n = read(fd, buf, sizeof(buf))) > 0)
     write(1, buf, n);
   if(n < 0){
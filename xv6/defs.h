@@ -2,10 +2,19 @@ struct buf;
 struct context;
 struct file;
 struct inode;
+struct iovec;
+struct meminfo;
 struct pipe;
 struct proc;
+struct procmem;
+struct shm;
+struct slabcache;
 struct spinlock;
 struct stat;
+struct superblock;
+struct vseg;
+struct dirstat;
+struct spawnact;
 
 // bio.c
 void            binit(void);
@@ -21,22 +30,35 @@ void            panic(char*) __attribute__((noreturn));
 
 // exec.c
 int             exec(char*, char**);
+int             execproc(struct proc*, char*, char**);
 
 // file.c
 struct file*    filealloc(void);
 void            fileclose(struct file*);
+int             filecopy(struct file*, struct file*, int n);
+int             filegetdents(struct file*, char*, int n, int);
 struct file*    filedup(struct file*);
 void            fileinit(void);
 int             fileread(struct file*, char*, int n);
+int             filemmap(struct file*, pde_t*, uint, uint, uint);
 int             filestat(struct file*, struct stat*);
+int             filepread(struct file*, char*, int n, uint off);
+int             filepwrite(struct file*, char*, int n, uint off);
+int             filereadv(struct file*, struct iovec*, int);
+int             filesplice(struct file*, struct file*, int n);
 int             filewrite(struct file*, char*, int n);
+int             filewritev(struct file*, struct iovec*, int);
 
 // fs.c
 int             dirlink(struct inode*, char*, uint);
+int             copyi(struct inode*, uint, struct inode*, uint, uint);
 struct inode*   dirlookup(struct inode*, char*, uint*);
+int             dirread(struct inode*, uint*, char*, int, int);
+int             dirreadstat(struct inode*, uint*, char*, int);
 struct inode*   ialloc(uint, short);
 struct inode*   idup(struct inode*);
 void            iinit(void);
+char*           ipage(struct inode*, uint);
 void            ilock(struct inode*);
 void            iput(struct inode*);
 void            iunlock(struct inode*);
@@ -46,6 +68,7 @@ int             namecmp(const char*, const char*);
 struct inode*   namei(char*);
 struct inode*   nameiparent(char*, char*);
 int             readi(struct inode*, char*, uint, uint);
+void            readsb(int dev, struct superblock*);
 void            stati(struct inode*, struct stat*);
 int             writei(struct inode*, char*, uint, uint);
 
@@ -60,9 +83,14 @@ extern uchar    ioapic_id;
 void            ioapic_init(void);
 
 // kalloc.c
-char*           kalloc(int);
+char*           kalloc(int, int);
+void            kdup(char*);
 void            kfree(char*, int);
 void            kinit(void);
+void            kmeminfo(struct meminfo*);
+char*           kzalloc(int);
+void            kzero(void);
+int             kshared(char*);
 
 // kbd.c
 void            kbd_intr(void);
@@ -84,10 +112,18 @@ void            mp_startthem(void);
 void            pic_enable(int);
 void            pic_init(void);
 
+// pcache.c
+void            pcinit(void);
+void            pcinsert(struct inode*, int, uint, char*);
+void            pcinval(struct inode*, uint, uint);
+char*           pclookup(struct inode*, int, uint);
+int             pcreclaim(void);
+
 // pipe.c
 int             pipealloc(struct file**, struct file**);
 void            pipeclose(struct pipe*, int);
 int             piperead(struct pipe*, char*, int);
+int             pipereadv(struct pipe*, struct iovec*, int);
 int             pipewrite(struct pipe*, char*, int);
 
 // proc.c
@@ -96,11 +132,18 @@ struct proc*    curproc(void);
 void            exit(void);
 int             growproc(int);
 int             kill(int);
+int             mmap(struct file*, uint, uint);
+int             munmap(uint, uint);
 void            pinit(void);
 void            procdump(void);
+int             procmem(int, struct procmem*);
 void            scheduler(void) __attribute__((noreturn));
+void            setrunnable(struct proc*);
 void            setupsegs(struct proc*);
 void            sleep(void*, struct spinlock*);
+int             spawn(char*, char**, struct spawnact*, int);
+void            swapdone(struct proc*);
+int             swapstart(struct proc*);
 void            userinit(void);
 int             wait(void);
 void            wakeup(void*);
@@ -109,6 +152,16 @@ void            yield(void);
 // swtch.S
 void            swtch(struct context*, struct context*);
 
+// shm.c
+int             shmalloc(struct file**, uint);
+void            shmclose(struct shm*);
+int             shmmap(struct shm*, pde_t*, uint, uint, uint);
+
+// slab.c
+void*           slaballoc(struct slabcache*);
+void            slabfree(struct slabcache*, void*);
+void            slabinit(struct slabcache*, char*, uint);
+
 // spinlock.c
 void            acquire(struct spinlock*);
 void            getcallerpcs(void*, uint*);
@@ -127,12 +180,22 @@ int             strlen(const char*);
 int             strncmp(const char*, const char*, uint);
 char*           strncpy(char*, const char*, int);
 
+// swap.c
+void            swapfree(int);
+void            swapin(void);
+void            swapinit(void);
+int             swapout(void);
+void            swapread(int, char*);
+int             swapwrite(char*);
+
 // syscall.c
 int             argint(int, int*);
 int             argptr(int, char**, int);
 int             argstr(int, char**);
+int             argwptr(int, char**, int);
 int             fetchint(struct proc*, uint, int*);
 int             fetchstr(struct proc*, uint, char**);
+int             prefault(struct proc*, uint, uint, int);
 void            syscall(void);
 
 // timer.c
@@ -144,6 +207,26 @@ extern int      ticks;
 void            tvinit(void);
 extern struct spinlock tickslock;
 
+// vm.c
+int             allocuvm(pde_t*, uint, uint);
+int             copyout(pde_t*, uint, void*, uint);
+pde_t*          copyuvm(pde_t*, uint);
+int             countuvm(pde_t*, uint);
+int             cowbreak(pde_t*, uint);
+int             cowfault(pde_t*, uint);
+void            deallocuvm(pde_t*, uint, uint);
+void            freevm(pde_t*);
+int             pagein(pde_t*, uint, struct inode*, struct vseg*, int);
+int             mapfile(pde_t*, uint, struct inode*, uint, uint);
+int             mapshared(pde_t*, uint, char**, int);
+pde_t*          setupkvm(void);
+int             swapinuvm(pde_t*, uint);
+int             swapoutuvm(pde_t*, uint);
+int             uvmshared(pde_t*, uint);
+char*           uva2ka(pde_t*, uint);
+void            vmenable(void);
+void            vminit(void);
+
 // number of elements in fixed-size array
 #define NELEM(x) (sizeof(x)/sizeof((x)[0]))
 
@@ -5,23 +5,44 @@
 #include "defs.h"
 #include "x86.h"
 #include "elf.h"
+#include "spinlock.h"
 
+extern struct spinlock proc_table_lock;
+
+// Replace the memory of the current process with
+// the program in path, called with arguments argv.
 int
 exec(char *path, char **argv)
 {
-  char *mem, *s, *last;
-  int i, argc, arglen, len, off;
-  uint sz, sp, argp;
+  return execproc(cp, path, argv);
+}
+
+// Load the program in path into a fresh address space for p,
+// which is the current process or a new one that has not
+// run yet, and set p up to start it.  On failure, p is left
+// as it was.  argv must be readable in the current process.
+//
+// Only the pages holding the arguments are filled in here.
+// The program's segments are recorded in p->seg and paged in
+// from the file (p->exe) when first touched; see pagein.
+int
+execproc(struct proc *p, char *path, char **argv)
+{
+  char *s, *last;
+  int i, argc, arglen, len, off, nseg;
+  uint a, sz, sp, argp, w;
+  pde_t *pgdir, *oldpgdir;
   struct elfhdr elf;
-  struct inode *ip;
+  struct inode *ip, *oldexe;
   struct proghdr ph;
+  struct vseg seg[NSEG];
 
   if((ip = namei(path)) == 0)
     return -1;
   ilock(ip);
 
   // Compute memory size of new process.
-  mem = 0;
+  pgdir = 0;
   sz = 0;
 
   // Program segments.
@@ -49,67 +70,93 @@ exec(char *path, char **argv)
   // Stack.
   sz += PAGE;
   
-  // Allocate program memory.
-  sz = (sz+PAGE-1) & ~(PAGE-1);
-  mem = kalloc(sz);
-  if(mem == 0)
-    goto bad;
-  memset(mem, 0, sz);
+  sz = PGROUNDUP(sz);
 
-  // Load program into memory.
+  // Record program segments, to be paged in later.
+  nseg = 0;
   for(i=0, off=elf.phoff; i<elf.phnum; i++, off+=sizeof(ph)){
     if(readi(ip, (char*)&ph, off, sizeof(ph)) != sizeof(ph))
       goto bad;
     if(ph.type != ELF_PROG_LOAD)
       continue;
-    if(ph.va + ph.memsz > sz)
-      goto bad;
-    if(readi(ip, mem + ph.va, ph.offset, ph.filesz) != ph.filesz)
+    if(ph.va + ph.memsz > sz || nseg >= NSEG)
       goto bad;
-    memset(mem + ph.va + ph.filesz, 0, ph.memsz - ph.filesz);
+    seg[nseg].va = ph.va;
+    seg[nseg].off = ph.offset;
+    seg[nseg].filesz = ph.filesz;
+    nseg++;
   }
-  iunlockput(ip);
-  
+  iunlock(ip);
+
   // Initialize stack.
   sp = sz;
   argp = sz - arglen - 4*(argc+1);
 
+  // Fill in the pages for the arguments and main's frame.
+  if((pgdir = setupkvm()) == 0)
+    goto badput;
+  for(a = PGROUNDDOWN(argp - 12); a < sz; a += PAGE)
+    if(pagein(pgdir, a, ip, seg, nseg) < 0)
+      goto badput;
+
   // Copy argv strings and pointers to stack.
-  *(uint*)(mem+argp + 4*argc) = 0;  // argv[argc]
+  // The new memory is not mapped yet, so go through pgdir.
+  w = 0;
+  if(copyout(pgdir, argp + 4*argc, &w, 4) < 0)  // argv[argc]
+    goto badput;
   for(i=argc-1; i>=0; i--){
     len = strlen(argv[i]) + 1;
     sp -= len;
-    memmove(mem+sp, argv[i], len);
-    *(uint*)(mem+argp + 4*i) = sp;  // argv[i]
+    if(copyout(pgdir, sp, argv[i], len) < 0 ||
+       copyout(pgdir, argp + 4*i, &sp, 4) < 0)  // argv[i]
+      goto badput;
   }
 
   // Stack frame for main(argc, argv), below arguments.
   sp = argp;
   sp -= 4;
-  *(uint*)(mem+sp) = argp;
+  if(copyout(pgdir, sp, &argp, 4) < 0)
+    goto badput;
   sp -= 4;
-  *(uint*)(mem+sp) = argc;
+  if(copyout(pgdir, sp, &argc, 4) < 0)
+    goto badput;
   sp -= 4;
-  *(uint*)(mem+sp) = 0xffffffff;   // fake return pc
+  w = 0xffffffff;
+  if(copyout(pgdir, sp, &w, 4) < 0)  // fake return pc
+    goto badput;
 
   // Save program name for debugging.
   for(last=s=path; *s; s++)
     if(*s == '/')
       last = s+1;
-  safestrcpy(cp->name, last, sizeof(cp->name));
+  safestrcpy(p->name, last, sizeof(p->name));
 
-  // Commit to the new image.
-  kfree(cp->mem, cp->sz);
-  cp->mem = mem;
-  cp->sz = sz;
-  cp->tf->eip = elf.entry;  // main
-  cp->tf->esp = sp;
-  setupsegs(cp);
+  // Commit to the new image.  procmem may be
+  // looking at the old page directory.
+  acquire(&proc_table_lock);
+  oldpgdir = p->pgdir;
+  p->pgdir = pgdir;
+  p->sz = sz;
+  release(&proc_table_lock);
+  oldexe = p->exe;
+  p->exe = ip;
+  memmove(p->seg, seg, sizeof(seg));
+  p->nseg = nseg;
+  p->tf->eip = elf.entry;  // main
+  p->tf->esp = sp;
+  if(p == cp)
+    setupsegs(p);
+  if(oldpgdir)
+    freevm(oldpgdir);
+  if(oldexe)
+    iput(oldexe);
   return 0;
 
  bad:
-  if(mem)
-    kfree(mem, sz);
-  iunlockput(ip);
+  iunlock(ip);
+ badput:
+  if(pgdir)
+    freevm(pgdir);
+  iput(ip);
   return -1;
 }
@@ -1,37 +1,41 @@
 #include "types.h"
 #include "defs.h"
 #include "param.h"
+#include "mmu.h"
+#include "proc.h"
+#include "stat.h"
 #include "file.h"
 #include "spinlock.h"
+#include "fs.h"
+#include "fsvar.h"
 #include "dev.h"
+#include "uio.h"
+#include "slab.h"
+#include "meminfo.h"
 
 struct devsw devsw[NDEV];
-struct spinlock file_table_lock;
-struct file file[NFILE];
+struct spinlock file_table_lock;  // protects reference counts
+struct slabcache filecache;
 
 void
 fileinit(void)
 {
   initlock(&file_table_lock, "file_table");
+  slabinit(&filecache, "file", sizeof(struct file));
 }
 
 // Allocate a file structure.
 struct file*
 filealloc(void)
 {
-  int i;
+  struct file *f;
 
-  acquire(&file_table_lock);
-  for(i = 0; i < NFILE; i++){
-    if(file[i].type == FD_CLOSED){
-      file[i].type = FD_NONE;
-      file[i].ref = 1;
-      release(&file_table_lock);
-      return file + i;
-    }
-  }
-  release(&file_table_lock);
-  return 0;
+  if((f = slaballoc(&filecache)) == 0)
+    return 0;
+  memset(f, 0, sizeof(*f));
+  f->type = FD_NONE;
+  f->ref = 1;
+  return f;
 }
 
 // Increment ref count for file f.
@@ -63,11 +67,14 @@ fileclose(struct file *f)
   f->ref = 0;
   f->type = FD_CLOSED;
   release(&file_table_lock);
-  
+  slabfree(&filecache, f);
+
   if(ff.type == FD_PIPE)
     pipeclose(ff.pipe, ff.writable);
   else if(ff.type == FD_INODE)
     iput(ff.ip);
+  else if(ff.type == FD_SHM)
+    shmclose(ff.shm);
   else
     panic("fileclose");
 }
@@ -85,6 +92,29 @@ filestat(struct file *f, struct stat *st)
   return -1;
 }
 
+// Read a batch of directory entries from directory f into addr,
+// as struct dirent, or as struct dirstat if withstat is set.
+// Returns the number of bytes filled in, 0 at end of directory.
+// Addr is kernel address.
+int
+filegetdents(struct file *f, char *addr, int n, int withstat)
+{
+  int r;
+
+  if(f->readable == 0 || f->type != FD_INODE)
+    return -1;
+  if(withstat)
+    return dirreadstat(f->ip, &f->off, addr, n);
+  ilock(f->ip);
+  if(f->ip->type != T_DIR){
+    iunlock(f->ip);
+    return -1;
+  }
+  r = dirread(f->ip, &f->off, addr, n, 0);
+  iunlock(f->ip);
+  return r;
+}
+
 // Read from file f.  Addr is kernel address.
 int
 fileread(struct file *f, char *addr, int n)
@@ -125,3 +155,194 @@ filewrite(struct file *f, char *addr, int n)
   panic("filewrite");
 }
 
+
+// Read from file f at offset off, without using or
+// updating f->off.  Pipes have no offset, so fail.
+// Addr is kernel address.
+int
+filepread(struct file *f, char *addr, int n, uint off)
+{
+  int r;
+
+  if(f->readable == 0 || f->type != FD_INODE)
+    return -1;
+  ilock(f->ip);
+  r = readi(f->ip, addr, off, n);
+  iunlock(f->ip);
+  return r;
+}
+
+// Map n bytes of file f from page-aligned offset off at
+// page-aligned user address va in pgdir: regular files
+// copy-on-write from the page cache, shared memory shared.
+// Returns 0, or -1 with nothing mapped.
+int
+filemmap(struct file *f, pde_t *pgdir, uint va, uint off, uint n)
+{
+  int r;
+
+  if(f->type == FD_SHM)
+    return shmmap(f->shm, pgdir, va, off, n);
+  if(f->readable == 0 || f->type != FD_INODE || off % PAGE)
+    return -1;
+  ilock(f->ip);
+  if(f->ip->type != T_FILE)
+    r = -1;
+  else
+    r = mapfile(pgdir, va, f->ip, off, n);
+  iunlock(f->ip);
+  return r;
+}
+
+// Write to file f at offset off, without using or
+// updating f->off.  Addr is kernel address.
+int
+filepwrite(struct file *f, char *addr, int n, uint off)
+{
+  int r;
+
+  if(f->writable == 0 || f->type != FD_INODE)
+    return -1;
+  ilock(f->ip);
+  r = writei(f->ip, addr, off, n);
+  iunlock(f->ip);
+  return r;
+}
+
+// Read from file f into the cnt buffers described by iov,
+// filling each in turn.  The inode stays locked across the
+// whole vector, so the read is atomic with respect to other
+// users of the file.  Iov bases are kernel addresses.
+int
+filereadv(struct file *f, struct iovec *iov, int cnt)
+{
+  int i, r, tot;
+
+  if(f->readable == 0)
+    return -1;
+  if(f->type == FD_PIPE)
+    return pipereadv(f->pipe, iov, cnt);
+  if(f->type == FD_INODE){
+    tot = 0;
+    ilock(f->ip);
+    for(i = 0; i < cnt; i++){
+      if((r = readi(f->ip, iov[i].base, f->off, iov[i].len)) < 0){
+        if(tot == 0)
+          tot = -1;
+        break;
+      }
+      f->off += r;
+      tot += r;
+      if(r < iov[i].len)
+        break;
+    }
+    iunlock(f->ip);
+    return tot;
+  }
+  panic("filereadv");
+}
+
+// Write the cnt buffers described by iov to file f.
+// Iov bases are kernel addresses.
+int
+filewritev(struct file *f, struct iovec *iov, int cnt)
+{
+  int i, r, tot;
+
+  if(f->writable == 0)
+    return -1;
+  tot = 0;
+  if(f->type == FD_PIPE){
+    for(i = 0; i < cnt; i++){
+      if((r = pipewrite(f->pipe, iov[i].base, iov[i].len)) < 0)
+        return tot > 0 ? tot : -1;
+      tot += r;
+    }
+    return tot;
+  }
+  if(f->type == FD_INODE){
+    ilock(f->ip);
+    for(i = 0; i < cnt; i++){
+      if((r = writei(f->ip, iov[i].base, f->off, iov[i].len)) < 0){
+        if(tot == 0)
+          tot = -1;
+        break;
+      }
+      f->off += r;
+      tot += r;
+      if(r < iov[i].len)
+        break;
+    }
+    iunlock(f->ip);
+    return tot;
+  }
+  panic("filewritev");
+}
+
+// Copy n bytes from file in to file out without passing
+// through user space, starting at and advancing both
+// files' offsets.  Both must be regular files, and distinct.
+int
+filecopy(struct file *in, struct file *out, int n)
+{
+  int r;
+  struct inode *ip0, *ip1;
+
+  if(in->readable == 0 || out->writable == 0)
+    return -1;
+  if(in->type != FD_INODE || out->type != FD_INODE || in->ip == out->ip)
+    return -1;
+
+  // Check types one at a time: in may be a directory,
+  // which must not be locked while holding another inode.
+  ilock(in->ip);
+  r = in->ip->type;
+  iunlock(in->ip);
+  if(r != T_FILE)
+    return -1;
+
+  // Lock in address order, so that two copies in
+  // opposite directions cannot deadlock.
+  ip0 = in->ip < out->ip ? in->ip : out->ip;
+  ip1 = in->ip < out->ip ? out->ip : in->ip;
+  ilock(ip0);
+  ilock(ip1);
+  if((r = copyi(in->ip, in->off, out->ip, out->off, n)) > 0){
+    in->off += r;
+    out->off += r;
+  }
+  iunlock(ip1);
+  iunlock(ip0);
+  return r;
+}
+
+// Move up to n bytes from file in to file out without
+// passing through user space: read a page at a time into a
+// kernel buffer and write it straight out.  Works for any mix
+// of inodes, devices and pipes, using and advancing inode
+// offsets as read and write would.  Stops early at end of
+// input.  Returns the number of bytes moved.
+int
+filesplice(struct file *in, struct file *out, int n)
+{
+  int r, tot;
+  char *buf;
+
+  if(in->readable == 0 || out->writable == 0)
+    return -1;
+  if((buf = kalloc(PAGE, KM_BUF)) == 0)
+    return -1;
+  r = 0;
+  for(tot = 0; tot < n && !cp->killed; tot += r){
+    if((r = fileread(in, buf, n - tot < PAGE ? n - tot : PAGE)) <= 0)
+      break;
+    if(filewrite(out, buf, r) != r){
+      r = -1;
+      break;
+    }
+  }
+  kfree(buf, PAGE);
+  if(tot == 0 && (r < 0 || cp->killed))
+    return -1;
+  return tot;
+}
@@ -1,9 +1,10 @@
 struct file {
-  enum { FD_CLOSED, FD_NONE, FD_PIPE, FD_INODE } type;
+  enum { FD_CLOSED, FD_NONE, FD_PIPE, FD_INODE, FD_SHM } type;
   int ref; // reference count
   char readable;
   char writable;
   struct pipe *pipe;
   struct inode *ip;
+  struct shm *shm;
   uint off;
 };
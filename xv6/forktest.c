@@ -1,5 +1,5 @@
 // Test that fork fails gracefully.
-// Tiny executable so that the limit can be filling the proc table.
+// Tiny executable so that the limit can be NPROC, the cap on processes.
 
 #include "types.h"
 #include "stat.h"
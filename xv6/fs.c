@@ -21,12 +21,14 @@
 #include "fs.h"
 #include "fsvar.h"
 #include "dev.h"
+#include "slab.h"
+#include "meminfo.h"
 
 #define min(a, b) ((a) < (b) ? (a) : (b))
 static void itrunc(struct inode*);
 
 // Read the super block.
-static void
+void
 readsb(int dev, struct superblock *sb)
 {
   struct buf *bp;
@@ -76,13 +78,92 @@ balloc(uint dev)
   panic("balloc: out of blocks");
 }
 
-// Free a disk block.
+// Block reference counts.
+//
+// A data block normally belongs to exactly one inode.  copyi
+// can make several inodes share a block; the number of extra
+// references beyond the first is kept in a byte per block
+// in the reference count blocks.  bfree only releases a block
+// once that count is zero, and writers copy a shared block
+// before changing it (see bmapw).
+//
+// Both inodes are marked shared when copyi shares a block,
+// and only they look at the counts, so writing and freeing
+// the blocks of ordinary files costs nothing extra.
+
+// Where the reference counts of the file system start,
+// read from the superblock the first time, as swapfind
+// does for the swap area.
+static struct {
+  struct spinlock lock;
+  uint dev;
+  uint ninodes;
+  uint size;
+  int valid;
+} rgeom;
+
+// Return the block holding the reference count of block b.
+// May read the superblock, so may sleep.
+static uint
+rblock(uint dev, uint b)
+{
+  uint ninodes, size;
+  struct superblock sb;
+
+  acquire(&rgeom.lock);
+  if(rgeom.valid && rgeom.dev == dev){
+    ninodes = rgeom.ninodes;
+    size = rgeom.size;
+    release(&rgeom.lock);
+    return RBLOCK(b, ninodes, size);
+  }
+  release(&rgeom.lock);
+  readsb(dev, &sb);
+  acquire(&rgeom.lock);
+  rgeom.dev = dev;
+  rgeom.ninodes = sb.ninodes;
+  rgeom.size = sb.size;
+  rgeom.valid = 1;
+  release(&rgeom.lock);
+  return RBLOCK(b, sb.ninodes, sb.size);
+}
+
+// Adjust the extra reference count of block b by delta.
+// Return the count before adjusting, or -1 if the
+// count would leave the range of a byte (leaving it unchanged).
+static int
+bref(uint dev, uint b, int delta)
+{
+  int n;
+  struct buf *bp;
+
+  bp = bread(dev, rblock(dev, b));
+  n = bp->data[b % RPB];
+  if(n + delta < 0 || n + delta > 0xff){
+    brelse(bp);
+    return -1;
+  }
+  if(delta != 0){
+    bp->data[b % RPB] = n + delta;
+    bwrite(bp);
+  }
+  brelse(bp);
+  return n;
+}
+
+// Free disk block b of inode ip, or drop
+// one reference to it if shared.
 static void
-bfree(int dev, uint b)
+bfree(struct inode *ip, uint b)
 {
   struct buf *bp;
   struct superblock sb;
   int bi, m;
+  uint dev;
+
+  dev = ip->dev;
+  if(ip->shared && bref(dev, b, -1) > 0)
+    return;
 
   bzero(dev, b);
 
@@ -129,48 +210,62 @@ bfree(int dev, uint b)
 // return pointers to *unlocked* inodes.  It is the callers'
 // responsibility to lock them before using them.  A non-zero
 // ip->ref keeps these unlocked inodes in the cache.
+//
+// In-memory inodes come from a slab cache and are found
+// through a hash table on inode number; the last iput
+// frees them.
+
+#define NIHASH 61  // buckets in icache.hash
 
 struct {
   struct spinlock lock;
-  struct inode inode[NINODE];
+  struct slabcache slab;
+  struct inode *hash[NIHASH];
 } icache;
 
 void
 iinit(void)
 {
   initlock(&icache.lock, "icache.lock");
+  initlock(&rgeom.lock, "rgeom");
+  slabinit(&icache.slab, "inode", sizeof(struct inode));
 }
 
 // Find the inode with number inum on device dev
-// and return the in-memory copy.
+// and return the in-memory copy, or 0 if there is
+// no memory for one even after swapping out a
+// sleeping process.  May sleep.
 static struct inode*
 iget(uint dev, uint inum)
 {
-  struct inode *ip, *empty;
+  struct inode *ip, **pp;
 
+again:
   acquire(&icache.lock);
 
   // Try for cached inode.
-  empty = 0;
-  for(ip = &icache.inode[0]; ip < &icache.inode[NINODE]; ip++){
-    if(ip->ref > 0 && ip->dev == dev && ip->inum == inum){
+  pp = &icache.hash[inum % NIHASH];
+  for(ip = *pp; ip; ip = ip->next){
+    if(ip->dev == dev && ip->inum == inum){
       ip->ref++;
       release(&icache.lock);
       return ip;
     }
-    if(empty == 0 && ip->ref == 0)    // Remember empty slot.
-      empty = ip;
   }
 
   // Allocate fresh inode.
-  if(empty == 0)
-    panic("iget: no inodes");
-
-  ip = empty;
+  if((ip = slaballoc(&icache.slab)) == 0){
+    release(&icache.lock);
+    if(swapout() == 0)
+      return 0;
+    goto again;
+  }
+  memset(ip, 0, sizeof(*ip));
   ip->dev = dev;
   ip->inum = inum;
   ip->ref = 1;
-  ip->flags = 0;
+  ip->next = *pp;
+  *pp = ip;
   release(&icache.lock);
 
   return ip;
@@ -210,6 +305,7 @@ ilock(struct inode *ip)
     ip->major = dip->major;
     ip->minor = dip->minor;
     ip->nlink = dip->nlink;
+    ip->shared = dip->shared;
     ip->size = dip->size;
     memmove(ip->addrs, dip->addrs, sizeof(ip->addrs));
     brelse(bp);
@@ -236,6 +332,8 @@ iunlock(struct inode *ip)
 void
 iput(struct inode *ip)
 {
+  struct inode **pp;
+
   acquire(&icache.lock);
   if(ip->ref == 1 && (ip->flags & I_VALID) && ip->nlink == 0){
     // inode is no longer used: truncate and free inode.
@@ -250,7 +348,12 @@ iput(struct inode *ip)
     ip->flags &= ~I_BUSY;
     wakeup(ip);
   }
-  ip->ref--;
+  if(--ip->ref == 0){
+    for(pp = &icache.hash[ip->inum % NIHASH]; *pp != ip; pp = &(*pp)->next)
+      ;
+    *pp = ip->next;
+    slabfree(&icache.slab, ip);
+  }
   release(&icache.lock);
 }
 
@@ -267,6 +370,7 @@ struct inode*
 ialloc(uint dev, short type)
 {
   int inum;
+  struct inode *ip;
   struct buf *bp;
   struct dinode *dip;
   struct superblock sb;
@@ -280,7 +384,14 @@ ialloc(uint dev, short type)
       dip->type = type;
       bwrite(bp);   // mark it allocated on the disk
       brelse(bp);
-      return iget(dev, inum);
+      if((ip = iget(dev, inum)) == 0){
+        bp = bread(dev, IBLOCK(inum));
+        dip = (struct dinode*)bp->data + inum%IPB;
+        dip->type = 0;  // give it back
+        bwrite(bp);
+        brelse(bp);
+      }
+      return ip;
     }
     brelse(bp);
   }
@@ -300,6 +411,7 @@ iupdate(struct inode *ip)
   dip->major = ip->major;
   dip->minor = ip->minor;
   dip->nlink = ip->nlink;
+  dip->shared = ip->shared;
   dip->size = ip->size;
   memmove(dip->addrs, ip->addrs, sizeof(ip->addrs));
   bwrite(bp);
@@ -356,6 +468,66 @@ bmap(struct inode *ip, uint bn, int alloc)
   panic("bmap: out of range");
 }
 
+// Set the disk block address of the nth block in inode ip
+// to addr, allocating the indirect block if necessary.
+// Return the previous address, 0 if there was none.
+static uint
+bset(struct inode *ip, uint bn, uint addr)
+{
+  uint old, *a;
+  struct buf *bp;
+
+  if(bn < NDIRECT){
+    old = ip->addrs[bn];
+    ip->addrs[bn] = addr;
+    iupdate(ip);
+    return old;
+  }
+  bn -= NDIRECT;
+
+  if(bn < NINDIRECT){
+    if(ip->addrs[INDIRECT] == 0){
+      ip->addrs[INDIRECT] = balloc(ip->dev);
+      iupdate(ip);
+    }
+    bp = bread(ip->dev, ip->addrs[INDIRECT]);
+    a = (uint*)bp->data;
+    old = a[bn];
+    a[bn] = addr;
+    bwrite(bp);
+    brelse(bp);
+    return old;
+  }
+
+  panic("bset: out of range");
+}
+
+// Return the disk block address of the nth block in inode ip,
+// allocating it if necessary, ready to be written.
+// If the block is shared with other inodes, give ip
+// its own copy first.
+static uint
+bmapw(struct inode *ip, uint bn)
+{
+  uint addr, naddr;
+  struct buf *bp, *nbp;
+
+  addr = bmap(ip, bn, 1);
+  if(!ip->shared || bref(ip->dev, addr, 0) == 0)
+    return addr;
+
+  naddr = balloc(ip->dev);
+  bp = bread(ip->dev, addr);
+  nbp = bread(ip->dev, naddr);
+  memmove(nbp->data, bp->data, BSIZE);
+  bwrite(nbp);
+  brelse(nbp);
+  brelse(bp);
+  bset(ip, bn, naddr);
+  bfree(ip, addr);
+  return naddr;
+}
+
 // Truncate inode (discard contents).
 static void
 itrunc(struct inode *ip)
@@ -366,7 +538,7 @@ itrunc(struct inode *ip)
 
   for(i = 0; i < NDIRECT; i++){
     if(ip->addrs[i]){
-      bfree(ip->dev, ip->addrs[i]);
+      bfree(ip, ip->addrs[i]);
       ip->addrs[i] = 0;
     }
   }
@@ -376,13 +548,15 @@ itrunc(struct inode *ip)
     a = (uint*)bp->data;
     for(j = 0; j < NINDIRECT; j++){
       if(a[j])
-        bfree(ip->dev, a[j]);
+        bfree(ip, a[j]);
     }
     brelse(bp);
     ip->addrs[INDIRECT] = 0;
   }
 
+  pcinval(ip, 0, 0xFFFFFFFF);
   ip->size = 0;
+  ip->shared = 0;  // no blocks left to share
   iupdate(ip);
 }
 
@@ -397,11 +571,38 @@ stati(struct inode *ip, struct stat *st)
   st->size = ip->size;
 }
 
+// Return the page of ip's contents at page-aligned offset off,
+// from the page cache or read in and added to it, with a
+// reference for the caller (drop it with kfree), or 0 if
+// out of memory.  Bytes past the end of the file are zero.
+// Caller must hold ip locked.
+char*
+ipage(struct inode *ip, uint off)
+{
+  uint o;
+  char *pa;
+  struct buf *bp;
+
+  if((pa = pclookup(ip, PC_FILE, off)) != 0)
+    return pa;
+  if((pa = kzalloc(KM_PCACHE)) == 0)
+    return 0;
+  for(o = off; o < off + PAGE && o < ip->size; o += BSIZE){
+    bp = bread(ip->dev, bmap(ip, o/BSIZE, 0));
+    memmove(pa + o - off, bp->data, min(BSIZE, ip->size - o));
+    brelse(bp);
+  }
+  pcinsert(ip, PC_FILE, off, pa);
+  return pa;
+}
+
 // Read data from inode.
+// Regular files are read through the page cache.
 int
 readi(struct inode *ip, char *dst, uint off, uint n)
 {
   uint tot, m;
+  char *pa;
   struct buf *bp;
 
   if(ip->type == T_DEV){
@@ -416,6 +617,13 @@ readi(struct inode *ip, char *dst, uint off, uint n)
     n = ip->size - off;
 
   for(tot=0; tot<n; tot+=m, off+=m, dst+=m){
+    if(ip->type == T_FILE && (pa = ipage(ip, PGROUNDDOWN(off))) != 0){
+      m = min(n - tot, PAGE - off%PAGE);
+      memmove(dst, pa + off%PAGE, m);
+      kfree(pa, PAGE);
+      continue;
+    }
+    // Directories, or out of memory for the page cache.
     bp = bread(ip->dev, bmap(ip, off/BSIZE, 0));
     m = min(n - tot, BSIZE - off%BSIZE);
     memmove(dst, bp->data + off%BSIZE, m);
@@ -437,13 +645,15 @@ writei(struct inode *ip, char *src, uint off, uint n)
     return devsw[ip->major].write(ip, src, n);
   }
 
-  if(off + n < off)
+  if(off > ip->size || off + n < off)
     return -1;
   if(off + n > MAXFILE*BSIZE)
     n = MAXFILE*BSIZE - off;
+  if(n > 0)
+    pcinval(ip, off, n);
 
   for(tot=0; tot<n; tot+=m, off+=m, src+=m){
-    bp = bread(ip->dev, bmap(ip, off/BSIZE, 1));
+    bp = bread(ip->dev, bmapw(ip, off/BSIZE));
     m = min(n - tot, BSIZE - off%BSIZE);
     memmove(bp->data + off%BSIZE, src, m);
     bwrite(bp);
@@ -457,6 +667,72 @@ writei(struct inode *ip, char *src, uint off, uint n)
   return n;
 }
 
+// Mark ip as sharing blocks with other inodes.
+static void
+ishare(struct inode *ip)
+{
+  if(!ip->shared){
+    ip->shared = 1;
+    iupdate(ip);
+  }
+}
+
+// Copy n bytes of sp starting at offset soff into dp at offset doff.
+// Whole blocks at matching alignment are not copied: dp is made
+// to share sp's disk block, which costs only a reference count.
+// A final partial block is shared too when nothing in dp follows it.
+// Returns the number of bytes copied, which is short if
+// reading or writing fails part way, or -1 if none were.
+// Caller must have locked both inodes, which must be distinct.
+int
+copyi(struct inode *sp, uint soff, struct inode *dp, uint doff, uint n)
+{
+  int r;
+  uint tot, m, addr;
+  char buf[BSIZE];
+
+  if(sp->type == T_DEV || dp->type == T_DEV)
+    return -1;
+  if(soff > sp->size || soff + n < soff)
+    return -1;
+  if(doff > dp->size || doff + n < doff)
+    return -1;
+  if(soff + n > sp->size)
+    n = sp->size - soff;
+  if(doff + n > MAXFILE*BSIZE)
+    n = MAXFILE*BSIZE - doff;
+
+  for(tot=0; tot<n; tot+=m, soff+=m, doff+=m){
+    m = min(n - tot, BSIZE - doff%BSIZE);
+    if(sp->dev == dp->dev && soff%BSIZE == 0 && doff%BSIZE == 0 &&
+       (m == BSIZE || (soff + m == sp->size && doff + m >= dp->size))){
+      addr = bmap(sp, soff/BSIZE, 0);
+      if(bref(sp->dev, addr, 1) >= 0){
+        ishare(sp);
+        ishare(dp);
+        pcinval(dp, doff, m);
+        if((addr = bset(dp, doff/BSIZE, addr)) != 0)
+          bfree(dp, addr);
+        if(doff + m > dp->size){
+          dp->size = doff + m;
+          iupdate(dp);
+        }
+        continue;
+      }
+    }
+    if(readi(sp, buf, soff, m) != m)
+      break;
+    if((r = writei(dp, buf, doff, m)) != m){
+      if(r > 0)
+        tot += r;
+      break;
+    }
+  }
+  if(tot < n)
+    return tot > 0 ? tot : -1;
+  return n;
+}
+
 // Directories
 
 int
@@ -465,11 +741,12 @@ namecmp(const char *s, const char *t)
   return strncmp(s, t, DIRSIZ);
 }
 
-// Look for a directory entry in a directory.
+// Look for a directory entry in a directory and
+// return its inode number, or 0 if there is none.
 // If found, set *poff to byte offset of entry.
 // Caller must have already locked dp.
-struct inode*
-dirlookup(struct inode *dp, char *name, uint *poff)
+static uint
+dirfind(struct inode *dp, char *name, uint *poff)
 {
   uint off, inum;
   struct buf *bp;
@@ -491,7 +768,7 @@ dirlookup(struct inode *dp, char *name, uint *poff)
           *poff = off + (uchar*)de - bp->data;
         inum = de->inum;
         brelse(bp);
-        return iget(dp->dev, inum);
+        return inum;
       }
     }
     brelse(bp);
@@ -499,19 +776,115 @@ dirlookup(struct inode *dp, char *name, uint *poff)
   return 0;
 }
 
+// Look for a directory entry in a directory and return
+// its inode, or 0 if there is none or no memory for it.
+// If found, set *poff to byte offset of entry.
+// Caller must have already locked dp.
+struct inode*
+dirlookup(struct inode *dp, char *name, uint *poff)
+{
+  uint inum;
+
+  if((inum = dirfind(dp, name, poff)) == 0)
+    return 0;
+  return iget(dp->dev, inum);
+}
+
+// Copy directory entries from dp into dst, starting at byte
+// offset *poff, skipping empty slots.  Entries are copied as
+// struct dirent, or as struct dirstat if withstat is set,
+// as many as fit in n bytes.  Advances *poff past the entries
+// consumed and returns the number of bytes copied.
+// The stat fields are left for dirreadstat to fill in.
+// Caller must have already locked dp.
+int
+dirread(struct inode *dp, uint *poff, char *dst, int n, int withstat)
+{
+  uint sz;
+  int tot;
+  struct dirent de;
+
+  if(dp->type != T_DIR)
+    panic("dirread not DIR");
+
+  sz = withstat ? sizeof(struct dirstat) : sizeof(de);
+  for(tot = 0; tot + sz <= n && *poff < dp->size; *poff += sizeof(de)){
+    if(readi(dp, (char*)&de, *poff, sizeof(de)) != sizeof(de))
+      panic("dirread");
+    if(de.inum == 0)
+      continue;
+    memmove(dst + tot, &de, sizeof(de));
+    tot += sz;
+  }
+  return tot;
+}
+
+// Entries read per batch by dirreadstat.
+#define NDIRSTAT 8
+
+// Read directory entries with their stat fields from the
+// unlocked directory dp into dst, as struct dirstat, as
+// many as fit in n bytes, starting at byte offset *poff.
+// Advances *poff and returns the number of bytes copied,
+// or -1 if dp is not a directory.
+//
+// Entries are read in batches into kernel memory.  The
+// inodes of a batch are referenced while dp is still
+// locked, so an unlink cannot free them, and then locked
+// and statted after dp is unlocked, since an entry may
+// name dp itself (".") or its parent ("..").
+int
+dirreadstat(struct inode *dp, uint *poff, char *dst, int n)
+{
+  int i, r, m, tot;
+  uint off;
+  struct dirstat ds[NDIRSTAT];
+  struct inode *ip[NDIRSTAT];
+
+  for(tot = 0; n - tot >= sizeof(ds[0]); tot += r){
+    m = n - tot;
+    if(m > sizeof(ds))
+      m = sizeof(ds);
+    ilock(dp);
+    if(dp->type != T_DIR){
+      iunlock(dp);
+      return -1;
+    }
+    off = *poff;
+    r = dirread(dp, poff, (char*)ds, m, 1);
+    for(i = 0; i < r / sizeof(ds[0]); i++){
+      if((ip[i] = iget(dp->dev, ds[i].inum)) == 0){
+        // Out of memory: leave this batch for the next call.
+        while(--i >= 0)
+          iput(ip[i]);
+        *poff = off;
+        iunlock(dp);
+        return tot > 0 ? tot : -1;
+      }
+    }
+    iunlock(dp);
+    if(r == 0)
+      break;
+    for(i = 0; i < r / sizeof(ds[0]); i++){
+      ilock(ip[i]);
+      stati(ip[i], &ds[i].st);
+      iunlockput(ip[i]);
+    }
+    memmove(dst + tot, ds, r);
+  }
+  return tot;
+}
+
 // Write a new directory entry (name, ino) into the directory dp.
 int
 dirlink(struct inode *dp, char *name, uint ino)
 {
   int off;
   struct dirent de;
-  struct inode *ip;
 
   // Check that name is not present.
-  if((ip = dirlookup(dp, name, 0)) != 0){
-    iput(ip);
+  if(dirfind(dp, name, 0) != 0)
     return -1;
-  }
 
   // Look for an empty dirent.
   for(off = 0; off < dp->size; off += sizeof(de)){
@@ -579,6 +952,8 @@ _namei(char *path, int parent, char *name)
     ip = iget(ROOTDEV, 1);
   else
     ip = idup(cp->cwd);
+  if(ip == 0)
+    return 0;
 
   while((path = skipelem(path, name)) != 0){
     ilock(ip);
@@ -4,6 +4,8 @@
 // Block 0 is unused.
 // Block 1 is super block.
 // Inodes start at block 2.
+// The block in-use bitmap follows the inodes,
+// then the block reference counts, then the data blocks.
 
 #define BSIZE 512  // block size
 
@@ -12,6 +14,7 @@ struct superblock {
   uint size;         // Size of file system image (blocks)
   uint nblocks;      // Number of data blocks
   uint ninodes;      // Number of inodes.
+  uint nswap;        // Number of swap blocks, after the file system
 };
 
 #define NADDRS (NDIRECT+1)
@@ -23,8 +26,9 @@ struct superblock {
 // On-disk inode structure
 struct dinode {
   short type;           // File type
-  short major;          // Major device number (T_DEV only)
-  short minor;          // Minor device number (T_DEV only)
+  uchar major;          // Major device number (T_DEV only)
+  uchar minor;          // Minor device number (T_DEV only)
+  short shared;         // Non-zero if blocks may be shared (see copyi)
   short nlink;          // Number of links to inode in file system
   uint size;            // Size of file (bytes)
   uint addrs[NADDRS];   // Data block addresses
@@ -46,6 +50,12 @@ struct dinode {
 // Block containing bit for block b
 #define BBLOCK(b, ninodes) (b/BPB + (ninodes)/IPB + 3)
 
+// Reference counts per block
+#define RPB           BSIZE
+
+// Block containing the reference count for block b
+#define RBLOCK(b, ninodes, size) ((b)/RPB + BBLOCK(size, ninodes) + 1)
+
 // Directory is a file containing a sequence of dirent structures.
 #define DIRSIZ 14
 
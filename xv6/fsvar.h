@@ -5,14 +5,20 @@ struct inode {
   uint inum;          // Inode number
   int ref;            // Reference count
   int flags;          // I_BUSY, I_VALID
+  struct inode *next; // Hash chain in icache
 
   short type;         // copy of disk inode
   short major;
   short minor;
   short nlink;
+  short shared;
   uint size;
   uint addrs[NADDRS];
 };
 
 #define I_BUSY 0x1
 #define I_VALID 0x2
+
+// Kinds of page cache pages (see pcache.c)
+#define PC_FILE  0  // file contents, keyed by offset
+#define PC_IMAGE 1  // program image, keyed by user address
@@ -1,116 +1,594 @@
 // Physical memory allocator, intended to allocate
 // memory for user processes. Allocates in 4096-byte "pages".
-// Free list is kept sorted and combines adjacent pages into
-// long runs, to make it easier to allocate big segments.
 // One reason the page size is 4k is that the x86 segment size
 // granularity is 4k.
+//
+// Free memory is managed as a binary buddy system: it is split
+// into blocks of 2^k pages, each aligned to its own size
+// (counting from the first managed page), on one free list per
+// order k.  Allocating splits a larger block in half until it is
+// the right size; freeing merges a block with its buddy, the
+// other half of the block it was split from, for as long as the
+// buddy is free too.  Both take O(log n) steps.
+//
+// Callers may allocate and free any whole number of pages.
+// kalloc rounds a request up to a power of two and gives back
+// the unused tail; kfree breaks a range into aligned blocks.
+//
+// A page may be shared, as user memory after fork is: kdup
+// counts an extra reference to it, and kfree drops one.
+//
+// Since user memory is paged (see vm.c), every allocation is a
+// single page, so free memory cannot be too fragmented to use.
+// When memory runs out, kalloc takes back the pages held by the
+// page cache that are not mapped anywhere before it gives up.
+//
+// Single pages (kernel stacks, pipes) are allocated and freed
+// mostly through a small cache per CPU, which is refilled from
+// and drained to the buddy lists KBATCH pages at a time, so that
+// kalloc_lock is taken only once per batch.
+//
+// CPUs with nothing to run zero free pages ahead of time into
+// a small pool (kzero), from which kzalloc hands out zeroed
+// pages for user memory and page tables without a memset.
+//
+// Every allocation is tagged with what it is for (KM_USER and
+// so on, in meminfo.h), so that kmeminfo can report where the
+// memory has gone.
 
 #include "types.h"
 #include "defs.h"
 #include "param.h"
 #include "spinlock.h"
+#include "x86.h"
+#include "meminfo.h"
+
+#define NORDER 16  // blocks of 1 to 2^15 pages
+#define KBATCH  4  // pages moved between a CPU cache and the lists
 
 struct spinlock kalloc_lock;
 
+struct kcache {
+  struct spinlock lock;
+  int n;                 // number of pages in page[]
+  char *page[2*KBATCH];  // free single pages
+};
+struct kcache kcache[NCPU];
+
+struct {
+  struct spinlock lock;
+  int n;                 // number of pages in page[]
+  char *page[NZPOOL];    // free pages, already zeroed
+} zpool;
+
 struct run {
   struct run *next;
-  int len; // bytes
+  struct run *prev;
+};
+struct run *freelist[NORDER];  // free blocks of each order
+
+char *kbase;    // first page managed by the allocator
+uint npages;    // number of pages managed
+uchar *korder;  // korder[i] is 1 + order of the free block
+                // starting at page i, or 0 if none does
+ushort *kshare; // kshare[i] is the number of extra
+                // references to allocated page i; every
+                // process and the page cache may hold one
+uchar *ktag;    // ktag[i] is the KM_ use of allocated page i
+
+static void freerange(uint, uint);
+
+#define E820MAP  0x8000  // memory map left by bootasm.S
+#define E820_RAM 1       // type of usable memory
+#define IO_RTC   0x70    // CMOS index port
+
+// Entry in the BIOS physical memory map.
+struct e820 {
+  uint addr;    // start, low 32 bits
+  uint addrhi;  // start, high 32 bits
+  uint len;     // length, low 32 bits
+  uint lenhi;   // length, high 32 bits
+  uint type;
 };
-struct run *freelist;
 
-// Initialize free list of physical pages.
-// This code cheats by just considering one megabyte of
-// pages after _end.  Real systems would determine the
-// amount of memory available in the system and use it all.
+static uint
+cmos(uint reg)
+{
+  outb(IO_RTC, reg);
+  return inb(IO_RTC+1);
+}
+
+// Without a BIOS memory map, describe extended memory
+// (from 1MB up) using the sizes recorded in CMOS.
+// Registers 0x17-0x18 count KB above 1MB, up to 64MB;
+// registers 0x34-0x35 count 64KB units above 16MB.
+static void
+cmosmem(struct e820 *e)
+{
+  uint kb, n64k;
+
+  kb = cmos(0x17) | cmos(0x18) << 8;
+  n64k = cmos(0x34) | cmos(0x35) << 8;
+  memset(e, 0, sizeof(*e));
+  e->addr = 0x100000;
+  e->len = kb * 1024;
+  if(kb >= 15*1024 && n64k > 0)
+    e->len = 15*1024*1024 + n64k * 64*1024;
+  e->type = E820_RAM;
+}
+
+// End of the part of e below 4GB.
+static uint
+e820end(struct e820 *e)
+{
+  if(e->addrhi)
+    return 0;
+  if(e->lenhi || e->addr + e->len < e->addr)
+    return 0xFFFFFFFF & ~(PAGE-1);
+  return (e->addr + e->len) & ~(PAGE-1);
+}
+
+// Initialize free lists of physical pages: all usable
+// memory above the kernel, up to 4GB, according to
+// the BIOS memory map, or CMOS if there is no map.
 void
 kinit(void)
 {
   extern int end;
-  uint mem;
+  uint i, n, lo, hi, top, meta, nfree;
   char *start;
+  struct e820 *e, cmosmap;
+  struct kcache *c;
 
   initlock(&kalloc_lock, "kalloc");
+  for(c = kcache; c < kcache+NCPU; c++)
+    initlock(&c->lock, "kcache");
+  initlock(&zpool.lock, "zpool");
   start = (char*) &end;
   start = (char*) (((uint)start + PAGE) & ~(PAGE-1));
-  mem = 256; // assume computer has 256 pages of RAM
-  cprintf("mem = %d\n", mem * PAGE);
-  kfree(start, mem * PAGE);
+
+  n = *(uint*)E820MAP;
+  e = (struct e820*)(E820MAP+4);
+  if(n == 0){
+    cmosmem(&cmosmap);
+    e = &cmosmap;
+    n = 1;
+    cprintf("mem: no BIOS map, using CMOS\n");
+  }
+  // Linear addresses from USERBASE up belong to user memory.
+  top = (uint)start;
+  for(i = 0; i < n; i++){
+    if(e[i].addrhi == 0)
+      cprintf("mem: %x-%x type %d\n", e[i].addr, e820end(&e[i]), e[i].type);
+    if(e[i].type == E820_RAM && e820end(&e[i]) > top)
+      top = e820end(&e[i]);
+  }
+  if(top > USERBASE)
+    top = USERBASE;
+  if(top < (uint)start + 2*PAGE){
+    cprintf("mem: no usable memory found, assuming 1MB\n");
+    top = (uint)start + 256*PAGE;
+    cmosmap.addr = (uint)start;
+    cmosmap.addrhi = cmosmap.lenhi = 0;
+    cmosmap.len = 256*PAGE;
+    cmosmap.type = E820_RAM;
+    e = &cmosmap;
+    n = 1;
+  }
+
+  // The per-page tables live in the first pages.
+  npages = (top - (uint)start) / PAGE;
+  meta = (4*npages + PAGE-1) / PAGE;
+  kshare = (ushort*)start;
+  korder = (uchar*)(kshare + npages);
+  ktag = korder + npages;
+  memset(kshare, 0, meta * PAGE);
+  kbase = start + meta * PAGE;
+  npages -= meta;
+
+  // Free the usable pages; holes stay allocated forever.
+  nfree = 0;
+  for(i = 0; i < n; i++){
+    if(e[i].type != E820_RAM || e[i].addrhi)
+      continue;
+    lo = (e[i].addr + PAGE-1) & ~(PAGE-1);
+    if(lo < (uint)kbase)
+      lo = (uint)kbase;
+    hi = e820end(&e[i]);
+    if(hi > top)
+      hi = top;
+    if(lo >= hi)
+      continue;
+    kfree((char*)lo, hi - lo);
+    nfree += (hi - lo) / PAGE;
+  }
+  cprintf("mem = %d pages (%dK) from %x to %x\n",
+          nfree, nfree * (PAGE/1024), kbase, top);
+}
+
+// Page number of kernel address v.
+static uint
+pageno(char *v)
+{
+  if(v < kbase || (uint)(v - kbase) % PAGE || (uint)(v - kbase) / PAGE >= npages)
+    panic("kalloc: bad address");
+  return (v - kbase) / PAGE;
+}
+
+// Push the free block of order k at page i onto its free list.
+static void
+pushfree(uint i, int k)
+{
+  struct run *r;
+
+  r = (struct run*)(kbase + i*PAGE);
+  r->prev = 0;
+  r->next = freelist[k];
+  if(r->next)
+    r->next->prev = r;
+  freelist[k] = r;
+  korder[i] = k + 1;
+}
+
+// Remove the free block of order k at page i from its free list.
+static void
+unlinkfree(uint i, int k)
+{
+  struct run *r;
+
+  r = (struct run*)(kbase + i*PAGE);
+  if(r->prev)
+    r->prev->next = r->next;
+  else
+    freelist[k] = r->next;
+  if(r->next)
+    r->next->prev = r->prev;
+  korder[i] = 0;
+}
+
+// Free the block of 2^k pages at page i,
+// merging it with its buddy as long as the buddy is free.
+static void
+freeblock(uint i, int k)
+{
+  uint b;
+
+  if(korder[i])
+    panic("freeing free page");
+  for(; k < NORDER-1; k++){
+    b = i ^ (1 << k);
+    if(b + (1 << k) > npages || korder[b] != k + 1)
+      break;
+    unlinkfree(b, k);
+    i &= ~(1 << k);
+  }
+  pushfree(i, k);
+}
+
+// Free pages i through i+n-1, as the largest
+// aligned blocks that fit.
+static void
+freerange(uint i, uint n)
+{
+  int k;
+
+  while(n > 0){
+    for(k = 0; k < NORDER-1; k++)
+      if((i & (1 << k)) || (2 << k) > n)
+        break;
+    freeblock(i, k);
+    i += 1 << k;
+    n -= 1 << k;
+  }
+}
+
+// Allocate np contiguous pages from the buddy lists.
+// Caller must hold kalloc_lock.
+static char*
+buddyalloc(uint np)
+{
+  uint i;
+  int j, k;
+
+  for(k = 0; k < NORDER && (1 << k) < np; k++)
+    ;
+  for(j = k; j < NORDER && freelist[j] == 0; j++)
+    ;
+  if(j >= NORDER)
+    return 0;
+  i = pageno((char*)freelist[j]);
+  unlinkfree(i, j);
+
+  // Split down to the smallest block that holds np pages,
+  // then give back the pages beyond np.
+  while(j > k){
+    j--;
+    pushfree(i + (1 << j), j);
+  }
+  freerange(i + np, (1 << k) - np);
+  return kbase + i*PAGE;
+}
+
+// Tag the np pages at v as being used for kind.
+static void
+settag(char *v, uint np, int kind)
+{
+  uint i;
+
+  for(i = pageno(v); np > 0; np--)
+    ktag[i++] = kind;
+}
+
+// Lock and return this CPU's page cache.
+static struct kcache*
+lockcache(void)
+{
+  struct kcache *c;
+
+  pushcli();
+  c = &kcache[cpu()];
+  acquire(&c->lock);
+  popcli();
+  return c;
+}
+
+// Take a single page from this CPU's cache,
+// refilling it from the buddy lists if empty.
+static char*
+cachealloc(void)
+{
+  char *p;
+  struct kcache *c;
+
+  c = lockcache();
+  if(c->n == 0){
+    acquire(&kalloc_lock);
+    while(c->n < KBATCH && (p = buddyalloc(1)) != 0)
+      c->page[c->n++] = p;
+    release(&kalloc_lock);
+  }
+  p = 0;
+  if(c->n > 0)
+    p = c->page[--c->n];
+  release(&c->lock);
+  return p;
+}
+
+// Put a single page in this CPU's cache,
+// draining half of it to the buddy lists if full.
+static void
+cachefree(char *v)
+{
+  struct kcache *c;
+
+  c = lockcache();
+  if(c->n == NELEM(c->page)){
+    acquire(&kalloc_lock);
+    while(c->n > KBATCH)
+      freeblock(pageno(c->page[--c->n]), 0);
+    release(&kalloc_lock);
+  }
+  c->page[c->n++] = v;
+  release(&c->lock);
+}
+
+// Return the pages cached by every CPU to the buddy lists,
+// where they can merge into larger blocks.
+// Returns the number of pages returned.
+static int
+drainall(void)
+{
+  int n;
+  struct kcache *c;
+
+  n = 0;
+  for(c = kcache; c < kcache+NCPU; c++){
+    acquire(&c->lock);
+    acquire(&kalloc_lock);
+    for(; c->n > 0; n++)
+      freeblock(pageno(c->page[--c->n]), 0);
+    release(&kalloc_lock);
+    release(&c->lock);
+  }
+  return n;
+}
+
+// Return the pages in the zero pool to the buddy lists.
+// Returns the number of pages returned.
+static int
+zdrain(void)
+{
+  int n;
+
+  acquire(&zpool.lock);
+  acquire(&kalloc_lock);
+  for(n = 0; zpool.n > 0; n++)
+    freeblock(pageno(zpool.page[--zpool.n]), 0);
+  release(&kalloc_lock);
+  release(&zpool.lock);
+  return n;
+}
+
+// Count another reference to the page at v,
+// so that the next kfree of it only drops a reference.
+void
+kdup(char *v)
+{
+  uint i;
+
+  acquire(&kalloc_lock);
+  i = pageno(v);
+  if(korder[i] || kshare[i] == 0xFFFF)
+    panic("kdup");
+  kshare[i]++;
+  release(&kalloc_lock);
+}
+
+// Is the page at v referenced more than once?
+int
+kshared(char *v)
+{
+  return kshare[pageno(v)] != 0;
 }
 
 // Free the len bytes of memory pointed at by v,
 // which normally should have been returned by a
 // call to kalloc(len).  (The exception is when
 // initializing the allocator; see kinit above.)
+// A shared page is only freed by its last kfree.
 void
 kfree(char *v, int len)
 {
-  struct run *r, *rend, **rp, *p, *pend;
+  uint i;
 
   if(len <= 0 || len % PAGE)
     panic("kfree");
 
+  // Only holders of a reference change kshare[i],
+  // so if it is 0 here, nobody else can make it nonzero.
+  if(len == PAGE && kshare[i = pageno(v)]){
+    acquire(&kalloc_lock);
+    if(kshare[i]){
+      kshare[i]--;
+      release(&kalloc_lock);
+      return;
+    }
+    release(&kalloc_lock);
+  }
+
+#ifdef KALLOC_DEBUG
   // Fill with junk to catch dangling refs.
   memset(v, 1, len);
+#endif
 
-  acquire(&kalloc_lock);
-  p = (struct run*)v;
-  pend = (struct run*)(v + len);
-  for(rp=&freelist; (r=*rp) != 0 && r <= pend; rp=&r->next){
-    rend = (struct run*)((char*)r + r->len);
-    if(r <= p && p < rend)
-      panic("freeing free page");
-    if(pend == r){  // p next to r: replace r with p
-      p->len = len + r->len;
-      p->next = r->next;
-      *rp = p;
-      goto out;
-    }
-    if(rend == p){  // r next to p: replace p with r
-      r->len += len;
-      if(r->next && r->next == pend){  // r now next to r->next?
-        r->len += r->next->len;
-        r->next = r->next->next;
-      }
-      goto out;
-    }
+  settag(v, len / PAGE, KM_FREE);
+  if(len == PAGE){
+    cachefree(v);
+    return;
   }
-  // Insert p before r in list.
-  p->len = len;
-  p->next = r;
-  *rp = p;
-
- out:
+  acquire(&kalloc_lock);
+  freerange(pageno(v), len / PAGE);
   release(&kalloc_lock);
 }
 
-// Allocate n bytes of physical memory.
+// Allocate n bytes of physical memory for kind (KM_USER etc.).
 // Returns a kernel-segment pointer.
 // Returns 0 if the memory cannot be allocated.
 char*
-kalloc(int n)
+kalloc(int n, int kind)
 {
   char *p;
-  struct run *r, **rp;
 
-  if(n % PAGE || n <= 0)
+  if(n % PAGE || n <= 0 || kind <= KM_FREE || kind >= NKM)
     panic("kalloc");
 
+  if(n == PAGE && (p = cachealloc()) != 0){
+    settag(p, 1, kind);
+    return p;
+  }
+
   acquire(&kalloc_lock);
-  for(rp=&freelist; (r=*rp) != 0; rp=&r->next){
-    if(r->len == n){
-      *rp = r->next;
-      release(&kalloc_lock);
-      return (char*)r;
-    }
-    if(r->len > n){
-      r->len -= n;
-      p = (char*)r + r->len;
-      release(&kalloc_lock);
-      return p;
+  p = buddyalloc(n / PAGE);
+  release(&kalloc_lock);
+
+  // Pages sitting in CPU caches or the zero pool
+  // may be keeping free blocks from merging.
+  if(p == 0 && drainall() + zdrain() > 0){
+    acquire(&kalloc_lock);
+    p = buddyalloc(n / PAGE);
+    release(&kalloc_lock);
+  }
+  // The page cache may be holding pages nobody is using.
+  // Freeing them fills this CPU's cache first.
+  if(p == 0 && pcreclaim() > 0){
+    drainall();
+    acquire(&kalloc_lock);
+    p = buddyalloc(n / PAGE);
+    release(&kalloc_lock);
+  }
+  // Running out is normal: callers swap or fall back.
+  if(p == 0)
+    return 0;
+  settag(p, n / PAGE, kind);
+  return p;
+}
+
+// Allocate a zeroed page, from the zero pool if it has one.
+// Returns 0 if the memory cannot be allocated.
+char*
+kzalloc(int kind)
+{
+  char *p;
+
+  if(kind <= KM_FREE || kind >= NKM)
+    panic("kzalloc");
+  p = 0;
+  acquire(&zpool.lock);
+  if(zpool.n > 0)
+    p = zpool.page[--zpool.n];
+  release(&zpool.lock);
+  if(p)
+    settag(p, 1, kind);
+  else if((p = kalloc(PAGE, kind)) != 0)
+    memset(p, 0, PAGE);
+  return p;
+}
+
+// Zero a free page into the zero pool, unless it is full.
+// Called by the scheduler when there is nothing to run.
+// Takes only memory that is free already, quietly.
+void
+kzero(void)
+{
+  char *p;
+
+  if(zpool.n >= NZPOOL || (p = cachealloc()) == 0)
+    return;
+  memset(p, 0, PAGE);
+  acquire(&zpool.lock);
+  if(zpool.n < NZPOOL){
+    zpool.page[zpool.n++] = p;
+    p = 0;
+  }
+  release(&zpool.lock);
+  if(p)
+    cachefree(p);
+}
+
+// Fill in *mi with the allocator's view of memory.
+// Pages in the CPU caches count as free; pages in
+// holes in the memory map count as neither free nor used.
+void
+kmeminfo(struct meminfo *mi)
+{
+  int k;
+  uint i;
+  struct run *r;
+  struct kcache *c;
+
+  memset(mi, 0, sizeof(*mi));
+  mi->npages = npages;
+  for(i = 0; i < npages; i++)
+    mi->nused[ktag[i]]++;
+  mi->nused[KM_FREE] = 0;
+
+  for(c = kcache; c < kcache+NCPU; c++){
+    acquire(&c->lock);
+    mi->nfree += c->n;
+    release(&c->lock);
+  }
+  acquire(&zpool.lock);
+  mi->nzero = zpool.n;
+  release(&zpool.lock);
+  mi->nfree += mi->nzero;
+
+  acquire(&kalloc_lock);
+  for(k = 0; k < NORDER && k < MI_NORDER; k++){
+    for(r = freelist[k]; r; r = r->next){
+      mi->nblock[k]++;
+      mi->nfree += 1 << k;
+      mi->largest = 1 << k;
     }
   }
   release(&kalloc_lock);
-
-  cprintf("kalloc: out of memory\n");
-  return 0;
 }
@@ -22,12 +22,14 @@ fmtname(char *path)
   return buf;
 }
 
+struct dirstat ents[32];
+
 void
 ls(char *path)
 {
   char buf[512], *p;
-  int fd;
-  struct dirent de;
+  int fd, n;
+  struct dirstat *ds;
   struct stat st;
   
   if((fd = open(path, 0)) < 0){
@@ -54,17 +56,16 @@ ls(char *path)
     strcpy(buf, path);
     p = buf+strlen(buf);
     *p++ = '/';
-    while(read(fd, &de, sizeof(de)) == sizeof(de)){
-      if(de.inum == 0)
-        continue;
-      memmove(p, de.name, DIRSIZ);
-      p[DIRSIZ] = 0;
-      if(stat(buf, &st) < 0){
-        printf(1, "ls: cannot stat %s\n", buf);
-        continue;
+    while((n = getdents(fd, ents, sizeof(ents), 1)) > 0){
+      for(ds = ents; ds < ents + n/sizeof(ents[0]); ds++){
+        memmove(p, ds->name, DIRSIZ);
+        p[DIRSIZ] = 0;
+        printf(1, "%s %d %d %d\n", fmtname(buf),
+               ds->st.type, ds->st.ino, ds->st.size);
       }
-      printf(1, "%s %d %d %d\n", fmtname(buf), st.type, st.ino, st.size);
     }
+    if(n < 0)
+      printf(1, "ls: cannot read %s\n", path);
     break;
   }
   close(fd);
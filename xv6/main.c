@@ -4,6 +4,7 @@
 #include "mmu.h"
 #include "proc.h"
 #include "x86.h"
+#include "meminfo.h"
 
 static void bootothers(void);
 static void mpmain(void) __attribute__((noreturn));
@@ -23,9 +24,12 @@ main(void)
 
   pinit();         // process table
   binit();         // buffer cache
+  pcinit();        // page cache
+  swapinit();      // swap area
   pic_init();      // interrupt controller
   ioapic_init();   // another interrupt controller
   kinit();         // physical memory allocator
+  vminit();        // kernel page table
   tvinit();        // trap vectors
   fileinit();      // file table
   iinit();         // inode cache
@@ -49,6 +53,7 @@ mpmain(void)
   idtinit();
   if(cpu() != mp_bcpu())
     lapic_init(cpu());
+  vmenable();
   setupsegs(0);
   xchg(&cpus[cpu()].booted, 1);
 
@@ -73,7 +78,7 @@ bootothers(void)
       continue;
 
     // Fill in %esp, %eip and start code on cpu.
-    stack = kalloc(KSTACKSIZE);
+    stack = kalloc(KSTACKSIZE, KM_BOOT);
     *(void**)(code-4) = stack + KSTACKSIZE;
     *(void**)(code-8) = mpmain;
     lapic_startap(c->apicid, (uint)code);
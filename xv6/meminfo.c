@@ -0,0 +1,50 @@
+// Print how memory is being used: by the kernel, free,
+// and by each process.  Sizes are in pages.
+
+#include "types.h"
+#include "stat.h"
+#include "user.h"
+#include "param.h"
+#include "meminfo.h"
+
+char *kinds[NKM] = {
+[KM_USER]   "user",
+[KM_PGTAB]  "pgtab",
+[KM_KSTACK] "kstack",
+[KM_BOOT]   "boot",
+[KM_PIPE]   "pipe",
+[KM_PCACHE] "pcache",
+[KM_SHM]    "shm",
+[KM_SLAB]   "slab",
+[KM_BUF]    "buf",
+};
+
+struct meminfo mi;
+struct procmem pm[NPROC];
+
+int
+main(int argc, char **argv)
+{
+  int i, n;
+
+  if((n = meminfo(&mi, pm, NPROC)) < 0){
+    printf(2, "meminfo: failed\n");
+    exit();
+  }
+
+  printf(1, "pages: %d total, %d free (%d zeroed), largest free block %d\n",
+         mi.npages, mi.nfree, mi.nzero, mi.largest);
+  printf(1, "used:");
+  for(i = 0; i < NKM; i++)
+    if(kinds[i])
+      printf(1, " %s %d", kinds[i], mi.nused[i]);
+  printf(1, "\nfree blocks:");
+  for(i = 0; i < MI_NORDER; i++)
+    if(mi.nblock[i])
+      printf(1, " %dx%d", mi.nblock[i], 1 << i);
+  printf(1, "\n\npid\tsize\trss\tswap\tname\n");
+  for(i = 0; i < n; i++)
+    printf(1, "%d\t%d\t%d\t%d\t%s\n", pm[i].pid, pm[i].sz / PAGE,
+           pm[i].rss, pm[i].nswap, pm[i].name);
+  exit();
+}
@@ -0,0 +1,35 @@
+// Memory usage, as reported by the meminfo system call.
+// Both the kernel and user programs use this header file.
+
+// What allocated pages are used for (see kalloc).
+#define KM_FREE    0  // not allocated
+#define KM_USER    1  // process memory
+#define KM_PGTAB   2  // page directories and page tables
+#define KM_KSTACK  3  // per-process kernel stacks
+#define KM_BOOT    4  // boot stacks of other CPUs
+#define KM_PIPE    5  // pipes
+#define KM_PCACHE  6  // page cache
+#define KM_SHM     7  // shared memory
+#define KM_SLAB    8  // slabs of files and inodes
+#define KM_BUF     9  // temporary kernel buffers
+#define NKM       10
+
+#define MI_NORDER 16  // free blocks of 2^0 to 2^15 pages
+
+struct meminfo {
+  uint npages;              // pages managed by kalloc
+  uint nfree;               // free pages, including nzero
+  uint nzero;               // free pages zeroed ahead of time
+  uint nused[NKM];          // allocated pages, by use
+  uint nblock[MI_NORDER];   // free blocks of 2^k pages
+  uint largest;             // pages in the largest free block
+};
+
+// Memory of one process.
+struct procmem {
+  int pid;
+  char name[16];
+  uint sz;     // size of memory (bytes)
+  uint rss;    // pages present in memory
+  uint nswap;  // pages swapped out
+};
@@ -7,9 +7,10 @@
 #include "types.h"
 #include "fs.h"
 
-int nblocks = 995;
+int nblocks = 992;
 int ninodes = 200;
 int size = 1024;
+int nswap = 2048;
 
 int fsfd;
 struct superblock sb;
@@ -17,6 +18,7 @@ char zeroes[512];
 uint freeblock;
 uint usedblocks;
 uint bitblocks;
+uint refblocks;
 uint freeinode = 1;
 
 void balloc(int);
@@ -76,17 +78,19 @@ main(int argc, char *argv[])
   sb.size = xint(size);
   sb.nblocks = xint(nblocks); // so whole disk is size sectors
   sb.ninodes = xint(ninodes);
+  sb.nswap = xint(nswap);
 
   bitblocks = size/(512*8) + 1;
-  usedblocks = ninodes / IPB + 3 + bitblocks;
+  refblocks = size/512 + 1;
+  usedblocks = ninodes / IPB + 3 + bitblocks + refblocks;
   freeblock = usedblocks;
 
-  printf("used %d (bit %d ninode %lu) free %u total %d\n", usedblocks,
-         bitblocks, ninodes/IPB + 1, freeblock, nblocks+usedblocks);
+  printf("used %d (bit %d ref %d ninode %lu) free %u total %d\n", usedblocks,
+         bitblocks, refblocks, ninodes/IPB + 1, freeblock, nblocks+usedblocks);
 
   assert(nblocks + usedblocks == size);
 
-  for(i = 0; i < nblocks + usedblocks; i++)
+  for(i = 0; i < nblocks + usedblocks + nswap; i++)
     wsect(i, zeroes);
 
   wsect(1, &sb);
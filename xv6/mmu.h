@@ -24,6 +24,39 @@
 #define FL_VIP          0x00100000      // Virtual Interrupt Pending
 #define FL_ID           0x00200000      // ID flag
 
+// Control Register flags
+#define CR0_PG          0x80000000      // Paging
+#define CR0_WP          0x00010000      // Write Protect, also in ring 0
+#define CR4_PSE         0x00000010      // Page Size Extensions (4MB pages)
+
+// A linear address la has a three-part structure:
+// +--------10------+-------10-------+---------12----------+
+// | Page Directory |   Page Table   | Offset within Page  |
+// |      Index     |      Index     |                     |
+// +----------------+----------------+---------------------+
+//  \--- PDX(la) --/ \--- PTX(la) --/
+#define PTXSHIFT        12      // offset of PTX in a linear address
+#define PDXSHIFT        22      // offset of PDX in a linear address
+#define PDX(la)         (((uint)(la) >> PDXSHIFT) & 0x3FF)
+#define PTX(la)         (((uint)(la) >> PTXSHIFT) & 0x3FF)
+#define NPDENTRIES      1024    // page directory entries per page directory
+#define NPTENTRIES      1024    // page table entries per page table
+
+#define PGROUNDUP(a)    (((a)+PAGE-1) & ~(PAGE-1))
+#define PGROUNDDOWN(a)  ((a) & ~(PAGE-1))
+
+// Page table/directory entry flags
+#define PTE_P           0x001   // Present
+#define PTE_W           0x002   // Writeable
+#define PTE_U           0x004   // User
+#define PTE_PS          0x080   // 4MB page (page directory entries only)
+#define PTE_SWAP        0x200   // Not present: swapped out (software)
+#define PTE_SHARED      0x400   // Shared memory, kept shared by fork (software)
+#define PTE_COW         0x800   // Copy on write (available to software)
+
+// Address in page table or page directory entry
+#define PTE_ADDR(pte)   ((uint)(pte) & ~0xFFF)
+
 // Segment Descriptor
 struct segdesc {
   uint lim_15_0 : 16;  // Low bits of segment limit
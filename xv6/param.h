@@ -1,10 +1,16 @@
-#define NPROC        64  // maximum number of processes
+#define NPROC       512  // maximum number of processes
 #define PAGE       4096  // granularity of user-space memory allocation
 #define KSTACKSIZE PAGE  // size of per-process kernel stack
+#define USERBASE 0x80000000  // linear address of user address 0
+#define USERMAX  0x40000000  // maximum size of a process's memory
 #define NCPU          8  // maximum number of CPUs
 #define NOFILE       16  // open files per process
-#define NFILE       100  // open files per system
+#define NSEG          4  // maximum loadable segments per program
+#define NPCACHE     128  // size of page cache
+#define NSWAP       256  // maximum pages in the swap area
+#define NZPOOL       32  // pages kept zeroed by idle CPUs
+#define NIOV         16  // maximum iovecs per readv/writev
+#define NSPAWNACT    16  // maximum file actions per spawn
 #define NBUF         10  // size of disk block cache
-#define NINODE       50  // maximum number of active i-nodes
 #define NDEV         10  // maximum major device number
 #define ROOTDEV       1  // device number of file system root disk
@@ -0,0 +1,136 @@
+// Page cache.
+//
+// Holds whole pages of file contents, keyed by inode and
+// page-aligned file offset.  readi copies regular file data
+// out of these pages, and mmap maps them into processes
+// directly (see ipage in fs.c).  The blocks under a page
+// are read through the buffer cache, which otherwise holds
+// directories, inodes and the free bitmap.
+//
+// The same table holds program image pages for pagein in
+// vm.c, keyed by user address rather than file offset.
+//
+// The cache holds one reference (see kdup) to each of its
+// pages, and whoever has one mapped holds another, so pages
+// can be replaced without regard to who is using them.
+// Writing a file drops its pages from the cache; processes
+// that have them mapped keep the old contents.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "fs.h"
+#include "fsvar.h"
+
+struct {
+  struct spinlock lock;
+  struct {
+    uint dev;   // file
+    uint inum;
+    int kind;   // PC_FILE or PC_IMAGE
+    uint key;   // file offset or user address
+    char *pa;   // 0 if slot is free
+  } page[NPCACHE];
+  int hand;     // next slot to replace
+} pcache;
+
+void
+pcinit(void)
+{
+  initlock(&pcache.lock, "pcache");
+}
+
+// Return the cached page of ip for kind and key,
+// with a reference for the caller, or 0.
+char*
+pclookup(struct inode *ip, int kind, uint key)
+{
+  int i;
+  char *pa;
+
+  pa = 0;
+  acquire(&pcache.lock);
+  for(i = 0; i < NPCACHE; i++){
+    if(pcache.page[i].pa && pcache.page[i].dev == ip->dev &&
+       pcache.page[i].inum == ip->inum && pcache.page[i].kind == kind &&
+       pcache.page[i].key == key){
+      pa = pcache.page[i].pa;
+      kdup(pa);
+      break;
+    }
+  }
+  release(&pcache.lock);
+  return pa;
+}
+
+// Add page pa to the cache as ip's page for kind and key,
+// replacing another page if the cache is full.
+// The caller keeps its own reference to pa.
+// Callers hold ip locked, so the page cannot be there yet.
+void
+pcinsert(struct inode *ip, int kind, uint key, char *pa)
+{
+  int i;
+
+  acquire(&pcache.lock);
+  for(i = 0; i < NPCACHE; i++)
+    if(pcache.page[i].pa == 0)
+      break;
+  if(i == NPCACHE){
+    i = pcache.hand;
+    pcache.hand = (i + 1) % NPCACHE;
+    kfree(pcache.page[i].pa, PAGE);
+  }
+  kdup(pa);
+  pcache.page[i].dev = ip->dev;
+  pcache.page[i].inum = ip->inum;
+  pcache.page[i].kind = kind;
+  pcache.page[i].key = key;
+  pcache.page[i].pa = pa;
+  release(&pcache.lock);
+}
+
+// Drop every cached page that is not also mapped somewhere,
+// for kalloc when memory runs out.
+// Returns the number of pages freed.
+int
+pcreclaim(void)
+{
+  int i, n;
+
+  n = 0;
+  acquire(&pcache.lock);
+  for(i = 0; i < NPCACHE; i++){
+    if(pcache.page[i].pa && !kshared(pcache.page[i].pa)){
+      kfree(pcache.page[i].pa, PAGE);
+      pcache.page[i].pa = 0;
+      n++;
+    }
+  }
+  release(&pcache.lock);
+  return n;
+}
+
+// The n bytes of ip at offset off are changing:
+// drop the file pages that hold them, and all of
+// ip's program image pages.
+void
+pcinval(struct inode *ip, uint off, uint n)
+{
+  int i;
+  uint key;
+
+  acquire(&pcache.lock);
+  for(i = 0; i < NPCACHE; i++){
+    if(pcache.page[i].pa == 0 || pcache.page[i].dev != ip->dev ||
+       pcache.page[i].inum != ip->inum)
+      continue;
+    key = pcache.page[i].key;
+    if(pcache.page[i].kind == PC_FILE && (key + PAGE <= off || key >= off + n))
+      continue;
+    kfree(pcache.page[i].pa, PAGE);
+    pcache.page[i].pa = 0;
+  }
+  release(&pcache.lock);
+}
@@ -5,18 +5,44 @@
 #include "proc.h"
 #include "file.h"
 #include "spinlock.h"
+#include "uio.h"
+#include "meminfo.h"
 
-#define PIPESIZE 512
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+// Bytes allocated per pipe, header included.
+// Must be a multiple of PAGE.
+#define PIPEALLOC PAGE
+
+// A reader sleeping on an empty pipe, offering its
+// buffers to the next writer to copy into directly.
+// Buffers in user memory (at USERBASE and up) belong to the
+// reader's address space, so the writer goes through its page
+// table; kernel buffers, as from splice, are the same for all.
+struct pipereader {
+  pde_t *pgdir;       // reader's page directory
+  struct iovec *iov;  // destination buffers (as seen by the reader)
+  int cnt;            // number of iovecs
+  int done;           // bytes copied in by a writer
+};
 
 struct pipe {
+  struct spinlock lock;
   int readopen;   // read fd is still open
   int writeopen;  // write fd is still open
-  uint writep;    // next index to write
-  uint readp;     // next index to read
-  struct spinlock lock;
-  char data[PIPESIZE];
+  uint readp;     // index of next byte to read
+  uint writep;    // index of next byte to write
+  uint nbytes;    // number of bytes in data
+  int nrwait;     // number of readers sleeping for data
+  int nwwait;     // number of writers sleeping for space
+  uint wwant;     // free space the sleeping writers are waiting for
+  struct pipereader *reader;  // reader waiting for a direct copy
+  char data[];    // ring buffer of PIPESIZE bytes
 };
 
+// The ring buffer fills the rest of the allocation.
+#define PIPESIZE (PIPEALLOC - sizeof(struct pipe))
+
 int
 pipealloc(struct file **f0, struct file **f1)
 {
@@ -26,12 +52,16 @@ pipealloc(struct file **f0, struct file **f1)
   *f0 = *f1 = 0;
   if((*f0 = filealloc()) == 0 || (*f1 = filealloc()) == 0)
     goto bad;
-  if((p = (struct pipe*)kalloc(PAGE)) == 0)
+  if((p = (struct pipe*)kalloc(PIPEALLOC, KM_PIPE)) == 0)
     goto bad;
   p->readopen = 1;
   p->writeopen = 1;
   p->writep = 0;
   p->readp = 0;
+  p->nbytes = 0;
+  p->nrwait = 0;
+  p->nwwait = 0;
+  p->reader = 0;
   initlock(&p->lock, "pipe");
   (*f0)->type = FD_PIPE;
   (*f0)->readable = 1;
@@ -45,7 +75,7 @@ pipealloc(struct file **f0, struct file **f1)
 
  bad:
   if(p)
-    kfree((char*)p, PAGE);
+    kfree((char*)p, PIPEALLOC);
   if(*f0){
     (*f0)->type = FD_NONE;
     fileclose(*f0);
@@ -71,27 +101,76 @@ pipeclose(struct pipe *p, int writable)
   release(&p->lock);
 
   if(p->readopen == 0 && p->writeopen == 0)
-    kfree((char*)p, PAGE);
+    kfree((char*)p, PIPEALLOC);
+}
+
+// Copy up to n bytes from addr straight into the buffers
+// of the reader waiting in pipereadv, bypassing the ring,
+// and wake it.  Return the number of bytes copied.
+static int
+pipehandoff(struct pipe *p, char *addr, int n)
+{
+  int j, m, tot;
+  uint dst;
+  struct pipereader *r;
+
+  r = p->reader;
+  tot = 0;
+  for(j = 0; j < r->cnt && tot < n; j++){
+    m = min(r->iov[j].len, n - tot);
+    dst = (uint)r->iov[j].base;
+    if(dst < USERBASE)
+      memmove((char*)dst, addr + tot, m);
+    else if(copyout(r->pgdir, dst - USERBASE, addr + tot, m) < 0)
+      break;
+    tot += m;
+  }
+  r->done = tot;
+  p->reader = 0;
+  wakeup(&p->readp);
+  return tot;
 }
 
+// Write n bytes into the pipe.  If a reader is already
+// waiting, hand the data to it directly; otherwise copy
+// as much as fits into the ring at a time.  Readers are
+// woken once per call, or when the buffer fills, and only
+// if any are asleep.
 int
 pipewrite(struct pipe *p, char *addr, int n)
 {
-  int i;
+  int i, m;
 
   acquire(&p->lock);
-  for(i = 0; i < n; i++){
-    while(p->writep == p->readp + PIPESIZE) {
+  for(i = 0; i < n; i += m){
+    if(p->reader && p->nbytes == 0){
+      m = pipehandoff(p, addr + i, n - i);
+      continue;
+    }
+    while(p->nbytes == PIPESIZE){
       if(p->readopen == 0 || cp->killed){
         release(&p->lock);
         return -1;
       }
-      wakeup(&p->readp);
+      if(p->nrwait)
+        wakeup(&p->readp);
+      // Ask to be woken once there is room for the rest
+      // of this write, or half the buffer, whichever is less.
+      m = min(n - i, PIPESIZE/2);
+      if(p->nwwait == 0 || m < p->wwant)
+        p->wwant = m;
+      p->nwwait++;
       sleep(&p->writep, &p->lock);
+      p->nwwait--;
     }
-    p->data[p->writep++ % PIPESIZE] = addr[i];
+    m = min(n - i, PIPESIZE - p->nbytes);
+    m = min(m, PIPESIZE - p->writep);
+    memmove(p->data + p->writep, addr + i, m);
+    p->writep = (p->writep + m) % PIPESIZE;
+    p->nbytes += m;
   }
-  wakeup(&p->readp);
+  if(p->nrwait)
+    wakeup(&p->readp);
   release(&p->lock);
   return i;
 }
@@ -99,22 +178,69 @@ pipewrite(struct pipe *p, char *addr, int n)
 int
 piperead(struct pipe *p, char *addr, int n)
 {
-  int i;
+  struct iovec iov;
+
+  iov.base = addr;
+  iov.len = n;
+  return pipereadv(p, &iov, 1);
+}
+
+// Read into the cnt buffers described by iov.
+// Sleeps only until some data is available, then
+// returns whatever the buffers can take without waiting.
+// While asleep, the first waiting reader offers its buffers
+// to writers, which then copy into them directly.
+// Sleeping writers are woken only once enough space is free.
+int
+pipereadv(struct pipe *p, struct iovec *iov, int cnt)
+{
+  int i, j, m, tot;
+  struct pipereader r;
+
+  r.pgdir = cp->pgdir;
+  r.iov = iov;
+  r.cnt = cnt;
+  r.done = 0;
+  for(tot = 0, j = 0; j < cnt; j++)
+    tot += iov[j].len;
 
   acquire(&p->lock);
-  while(p->readp == p->writep && p->writeopen){
+  cp->pinned++;  // writers may copy into our memory while we sleep
+  while(p->nbytes == 0 && p->writeopen){
     if(cp->killed){
+      if(p->reader == &r)
+        p->reader = 0;
+      cp->pinned--;
       release(&p->lock);
       return -1;
     }
+    if(p->reader == 0 && tot > 0)
+      p->reader = &r;
+    p->nrwait++;
     sleep(&p->readp, &p->lock);
+    p->nrwait--;
+    if(r.done > 0){
+      cp->pinned--;
+      release(&p->lock);
+      return r.done;
+    }
   }
-  for(i = 0; i < n; i++){
-    if(p->readp == p->writep)
-      break;
-    addr[i] = p->data[p->readp++ % PIPESIZE];
+  cp->pinned--;
+  if(p->reader == &r)
+    p->reader = 0;
+  tot = 0;
+  for(j = 0; j < cnt && p->nbytes > 0; j++){
+    for(i = 0; i < iov[j].len && p->nbytes > 0; i += m){
+      m = min(iov[j].len - i, p->nbytes);
+      m = min(m, PIPESIZE - p->readp);
+      memmove((char*)iov[j].base + i, p->data + p->readp, m);
+      p->readp = (p->readp + m) % PIPESIZE;
+      p->nbytes -= m;
+      tot += m;
+    }
   }
-  wakeup(&p->writep);
+  if(p->nwwait && PIPESIZE - p->nbytes >= p->wwant)
+    wakeup(&p->writep);
   release(&p->lock);
-  return i;
+  return tot;
 }
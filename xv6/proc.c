@@ -5,65 +5,250 @@
 #include "x86.h"
 #include "proc.h"
 #include "spinlock.h"
-
+#include "spawn.h"
+#include "meminfo.h"
+#include "slab.h"
+
+// Processes are allocated from a slab cache, up to NPROC
+// at a time, and linked on allproc.  A few UNUSED ones are
+// kept on a list with their kernel stacks, so that most
+// forks allocate neither.
+//
+// proc_table_lock protects the process lists: allproc, the
+// unused list, the pid hash, parent and child links, and the
+// move to ZOMBIE and back to UNUSED that exit and wait make.
+// Each process keeps a list of its children, so wait and exit
+// look only at those, and kill finds a pid through a hash.
+//
+// Sleeping processes wait on a queue for their channel, one of
+// NWAITQ hashed by channel address, each with its own lock;
+// wakeup looks only at the queue for its channel.
+//
+// Each CPU has a queue of RUNNABLE processes with its own
+// lock.  The scheduler holds its queue's lock, not
+// proc_table_lock, while switching to a process and back,
+// so CPUs schedule in parallel.  A process that is switching
+// out holds the lock of the queue it will be found on: yield
+// puts it on this CPU's queue, and wakeup puts a sleeping
+// process back on the queue of the CPU it last ran on
+// (p->cpu), which cannot take it until it is off that CPU.
+// A CPU whose queue is empty steals from another CPU's.
 struct spinlock proc_table_lock;
 
-struct proc proc[NPROC];
+struct runq {
+  struct spinlock lock;
+  struct proc *head;  // next to run
+  struct proc *tail;
+  int n;              // number of processes queued
+};
+struct runq runq[NCPU];
+
+#define NWAITQ 64
+#define WAITQ(chan) (&waitq[((uint)(chan) >> 3) % NWAITQ])
+
+struct waitq {
+  struct spinlock lock;
+  struct proc *head;  // sleeping processes, linked by next
+};
+struct waitq waitq[NWAITQ];
+
+#define NPIDHASH 64
+struct proc *pidhash[NPIDHASH];  // chains linked by pidnext
+
+#define NUNUSED 16  // UNUSED processes kept with their stacks
+
+struct slabcache proccache;
+struct proc *allproc;   // every process but UNUSED ones, by pid
+struct proc *lastproc;  // last on allproc
+struct proc *unused;    // UNUSED processes, linked by next
+int nunused;            // number of processes on unused
+int nproc;              // number of processes not UNUSED
 static struct proc *initproc;
 
 int nextpid = 1;
 extern void forkret(void);
 extern void forkret1(struct trapframe*);
+extern pde_t *kpgdir;
 
 void
 pinit(void)
 {
+  struct runq *rq;
+  struct waitq *wq;
+
   initlock(&proc_table_lock, "proc_table");
+  for(rq = runq; rq < runq+NCPU; rq++)
+    initlock(&rq->lock, "runq");
+  for(wq = waitq; wq < waitq+NWAITQ; wq++)
+    initlock(&wq->lock, "waitq");
+  slabinit(&proccache, "proc", sizeof(struct proc));
 }
 
-// Look in the process table for an UNUSED proc.
-// If found, change state to EMBRYO and return it.
-// Otherwise return 0.
+// Allocate a proc with a kernel stack, reusing an UNUSED
+// one if there is one.  Change its state to EMBRYO, give it
+// a pid and make it a child of parent (if any), and return it.
+// Returns 0 if there are NPROC processes already or there is
+// no memory.
 static struct proc*
-allocproc(void)
+allocproc(struct proc *parent)
 {
-  int i;
+  char *kstack;
   struct proc *p;
 
   acquire(&proc_table_lock);
-  for(i = 0; i < NPROC; i++){
-    p = &proc[i];
-    if(p->state == UNUSED){
-      p->state = EMBRYO;
-      p->pid = nextpid++;
-      release(&proc_table_lock);
-      return p;
-    }
+  if(nproc >= NPROC){
+    release(&proc_table_lock);
+    return 0;
+  }
+  nproc++;
+  if((p = unused) != 0){
+    unused = p->next;
+    nunused--;
   }
   release(&proc_table_lock);
-  return 0;
+
+  if(p)
+    kstack = p->kstack;
+  else if((p = slaballoc(&proccache)) == 0 ||
+          (kstack = kalloc(KSTACKSIZE, KM_KSTACK)) == 0){
+    if(p)
+      slabfree(&proccache, p);
+    acquire(&proc_table_lock);
+    nproc--;
+    release(&proc_table_lock);
+    return 0;
+  }
+  memset(p, 0, sizeof(*p));
+  p->kstack = kstack;
+
+  // Pids only grow, so appending keeps allproc in pid order.
+  acquire(&proc_table_lock);
+  p->state = EMBRYO;
+  p->pid = nextpid++;
+  p->pidnext = pidhash[p->pid % NPIDHASH];
+  pidhash[p->pid % NPIDHASH] = p;
+  p->parent = parent;
+  if(parent){
+    p->sibling = parent->children;
+    parent->children = p;
+  }
+  p->allprev = lastproc;
+  if(lastproc)
+    lastproc->allnext = p;
+  else
+    allproc = p;
+  lastproc = p;
+  release(&proc_table_lock);
+  return p;
+}
+
+// Take p, which is not running, out of the pid hash, its
+// parent's children and allproc, mark it UNUSED, and keep
+// it for reuse or free it.  Caller holds proc_table_lock.
+static void
+unlinkproc(struct proc *p)
+{
+  struct proc **pp;
+
+  for(pp = &pidhash[p->pid % NPIDHASH]; *pp != p; pp = &(*pp)->pidnext)
+    ;
+  *pp = p->pidnext;
+  if(p->parent){
+    for(pp = &p->parent->children; *pp != p; pp = &(*pp)->sibling)
+      ;
+    *pp = p->sibling;
+  }
+  if(p->allprev)
+    p->allprev->allnext = p->allnext;
+  else
+    allproc = p->allnext;
+  if(p->allnext)
+    p->allnext->allprev = p->allprev;
+  else
+    lastproc = p->allprev;
+  p->state = UNUSED;
+  p->pid = 0;
+  nproc--;
+
+  if(nunused < NUNUSED){
+    p->next = unused;
+    unused = p;
+    nunused++;
+  } else {
+    kfree(p->kstack, KSTACKSIZE);
+    slabfree(&proccache, p);
+  }
+}
+
+// Set the current process's size to sz.  The user segment
+// registers pick up the new limits on the way back to user space.
+static void
+setsz(uint sz)
+{
+  struct cpu *c;
+
+  cp->sz = sz;
+  pushcli();
+  c = &cpus[cpu()];
+  c->gdt[SEG_UCODE] = SEG(STA_X|STA_R, USERBASE, sz-1, DPL_USER);
+  c->gdt[SEG_UDATA] = SEG(STA_W, USERBASE, sz-1, DPL_USER);
+  popcli();
 }
 
-// Grow current process's memory by n bytes.
+// Grow current process's memory by n bytes, or shrink it
+// if n is negative.  The memory already there stays in place:
+// only the new pages are mapped, and only the user segment
+// limits change.  (deallocuvm flushes the TLB on shrinking.)
 // Return old size on success, -1 on failure.
 int
 growproc(int n)
 {
-  char *newmem;
+  uint sz;
 
-  newmem = kalloc(cp->sz + n);
-  if(newmem == 0)
+  sz = cp->sz;
+  if(n > 0 && allocuvm(cp->pgdir, sz, sz + n) < 0)
     return -1;
-  memmove(newmem, cp->mem, cp->sz);
-  memset(newmem + cp->sz, 0, n);
-  kfree(cp->mem, cp->sz);
-  cp->mem = newmem;
-  cp->sz += n;
-  setupsegs(cp);
-  return cp->sz - n;
+  if(n < 0){
+    if(-n >= sz)
+      return -1;
+    deallocuvm(cp->pgdir, sz, sz + n);
+  }
+  setsz(sz + n);
+  return sz;
+}
+
+// Map len bytes of file f from page-aligned offset off
+// past the end of the current process's memory, which
+// grows to include them (see filemmap).
+// Returns the address of the mapping, or -1.
+int
+mmap(struct file *f, uint off, uint len)
+{
+  uint va;
+
+  va = PGROUNDUP(cp->sz);
+  if(len == 0 || va + len < va || filemmap(f, cp->pgdir, va, off, len) < 0)
+    return -1;
+  setsz(PGROUNDUP(va + len));
+  return va;
+}
+
+// Unmap the pages holding addr to addr+len in the current
+// process.  They read as zeros if touched again.  Memory
+// at the end of the process is given up, as by sbrk.
+int
+munmap(uint addr, uint len)
+{
+  if(addr % PAGE || addr + len < addr || addr + len > cp->sz)
+    return -1;
+  deallocuvm(cp->pgdir, addr + len, addr);
+  if(PGROUNDUP(addr + len) >= cp->sz && addr > 0)
+    setsz(addr);
+  return 0;
 }
 
-// Set up CPU's segment descriptors and task state for a given process.
+// Set up CPU's segment descriptors, task state and page table
+// for a given process.
 // If p==0, set up for "idle" state for when scheduler() is running.
 void
 setupsegs(struct proc *p)
@@ -79,13 +264,13 @@ setupsegs(struct proc *p)
     c->ts.esp0 = 0xffffffff;
 
   c->gdt[0] = SEG_NULL;
-  c->gdt[SEG_KCODE] = SEG(STA_X|STA_R, 0, 0x100000 + 64*1024-1, 0);
+  c->gdt[SEG_KCODE] = SEG(STA_X|STA_R, 0, 0x100000 + 128*1024-1, 0);
   c->gdt[SEG_KDATA] = SEG(STA_W, 0, 0xffffffff, 0);
   c->gdt[SEG_TSS] = SEG16(STS_T32A, (uint)&c->ts, sizeof(c->ts)-1, 0);
   c->gdt[SEG_TSS].s = 0;
   if(p){
-    c->gdt[SEG_UCODE] = SEG(STA_X|STA_R, (uint)p->mem, p->sz-1, DPL_USER);
-    c->gdt[SEG_UDATA] = SEG(STA_W, (uint)p->mem, p->sz-1, DPL_USER);
+    c->gdt[SEG_UCODE] = SEG(STA_X|STA_R, USERBASE, p->sz-1, DPL_USER);
+    c->gdt[SEG_UDATA] = SEG(STA_W, USERBASE, p->sz-1, DPL_USER);
   } else {
     c->gdt[SEG_UCODE] = SEG_NULL;
     c->gdt[SEG_UDATA] = SEG_NULL;
@@ -93,43 +278,27 @@ setupsegs(struct proc *p)
 
   lgdt(c->gdt, sizeof(c->gdt));
   ltr(SEG_TSS << 3);
+  lcr3(p ? (uint)p->pgdir : (uint)kpgdir);
   popcli();
 }
 
-// Create a new process copying p as the parent.
+// Create a new process with p as the parent, and
+// p's registers, open files and current directory,
+// but no memory yet.
 // Sets up stack to return as if from system call.
-// Caller must set state of returned proc to RUNNABLE.
-struct proc*
-copyproc(struct proc *p)
+static struct proc*
+forkproc(struct proc *p)
 {
   int i;
   struct proc *np;
 
-  // Allocate process.
-  if((np = allocproc()) == 0)
+  // Allocate process and kernel stack.
+  if((np = allocproc(p)) == 0)
     return 0;
-
-  // Allocate kernel stack.
-  if((np->kstack = kalloc(KSTACKSIZE)) == 0){
-    np->state = UNUSED;
-    return 0;
-  }
   np->tf = (struct trapframe*)(np->kstack + KSTACKSIZE) - 1;
 
   if(p){  // Copy process state from p.
-    np->parent = p;
     memmove(np->tf, p->tf, sizeof(*np->tf));
-  
-    np->sz = p->sz;
-    if((np->mem = kalloc(np->sz)) == 0){
-      kfree(np->kstack, KSTACKSIZE);
-      np->kstack = 0;
-      np->state = UNUSED;
-      np->parent = 0;
-      return 0;
-    }
-    memmove(np->mem, p->mem, np->sz);
-
     for(i = 0; i < NOFILE; i++)
       if(p->ofile[i])
         np->ofile[i] = filedup(p->ofile[i]);
@@ -146,16 +315,122 @@ copyproc(struct proc *p)
   return np;
 }
 
+// Undo forkproc for a process that never ran.
+static void
+freeproc(struct proc *np)
+{
+  int fd;
+
+  for(fd = 0; fd < NOFILE; fd++){
+    if(np->ofile[fd]){
+      fileclose(np->ofile[fd]);
+      np->ofile[fd] = 0;
+    }
+  }
+  if(np->cwd){
+    iput(np->cwd);
+    np->cwd = 0;
+  }
+  if(np->exe){
+    iput(np->exe);
+    np->exe = 0;
+  }
+  if(np->pgdir){
+    freevm(np->pgdir);
+    np->pgdir = 0;
+  }
+  acquire(&proc_table_lock);
+  unlinkproc(np);
+  release(&proc_table_lock);
+}
+
+// Create a new process copying p as the parent.
+// Sets up stack to return as if from system call.
+// Caller must pass the returned proc to setrunnable.
+struct proc*
+copyproc(struct proc *p)
+{
+  struct proc *np;
+
+  if((np = forkproc(p)) == 0)
+    return 0;
+
+  // Share the parent's memory copy-on-write, and
+  // its program file for paging in the rest.
+  if(p){
+    np->sz = p->sz;
+    if((np->pgdir = copyuvm(p->pgdir, p->sz)) == 0){
+      freeproc(np);
+      return 0;
+    }
+    if(p->exe)
+      np->exe = idup(p->exe);
+    memmove(np->seg, p->seg, sizeof(p->seg));
+    np->nseg = p->nseg;
+  }
+  return np;
+}
+
+// Create a child of the current process running the program
+// in path with arguments argv, without copying the parent's
+// memory as fork would.  The child starts with the parent's
+// open files, as changed by the nact actions in act.
+// Returns the child's pid, or -1.
+int
+spawn(char *path, char **argv, struct spawnact *act, int nact)
+{
+  int i, fd, src;
+  struct proc *np;
+
+  if((np = forkproc(cp)) == 0)
+    return -1;
+  for(i = 0; i < nact; i++){
+    fd = act[i].fd;
+    if(fd < 0 || fd >= NOFILE)
+      goto bad;
+    switch(act[i].op){
+    case SPAWN_DUP:
+      src = act[i].src;
+      if(src < 0 || src >= NOFILE || np->ofile[src] == 0)
+        goto bad;
+      if(src == fd)
+        break;
+      if(np->ofile[fd])
+        fileclose(np->ofile[fd]);
+      np->ofile[fd] = filedup(np->ofile[src]);
+      break;
+    case SPAWN_CLOSE:
+      if(np->ofile[fd]){
+        fileclose(np->ofile[fd]);
+        np->ofile[fd] = 0;
+      }
+      break;
+    default:
+      goto bad;
+    }
+  }
+  if(execproc(np, path, argv) < 0)
+    goto bad;
+  setrunnable(np);
+  return np->pid;
+
+ bad:
+  freeproc(np);
+  return -1;
+}
+
 // Set up first user process.
 void
 userinit(void)
 {
   struct proc *p;
+  uint ret;
   extern uchar _binary_initcode_start[], _binary_initcode_size[];
   
   p = copyproc(0);
   p->sz = PAGE;
-  p->mem = kalloc(p->sz);
+  if((p->pgdir = setupkvm()) == 0 || allocuvm(p->pgdir, 0, p->sz) < 0)
+    panic("userinit");
   p->cwd = namei("/");
   memset(p->tf, 0, sizeof(*p->tf));
   p->tf->cs = (SEG_UCODE << 3) | DPL_USER;
@@ -167,13 +442,14 @@ userinit(void)
   
   // Make return address readable; needed for some gcc.
   p->tf->esp -= 4;
-  *(uint*)(p->mem + p->tf->esp) = 0xefefefef;
+  ret = 0xefefefef;
+  copyout(p->pgdir, p->tf->esp, &ret, 4);
 
   // On entry to user space, start executing at beginning of initcode.S.
   p->tf->eip = 0;
-  memmove(p->mem, _binary_initcode_start, (int)_binary_initcode_size);
+  copyout(p->pgdir, 0, _binary_initcode_start, (int)_binary_initcode_size);
   safestrcpy(p->name, "initcode", sizeof(p->name));
-  p->state = RUNNABLE;
+  setrunnable(p);
   
   initproc = p;
 }
@@ -190,10 +466,176 @@ curproc(void)
   return p;
 }
 
+// Lock and return this CPU's run queue.
+static struct runq*
+lockrunq(void)
+{
+  struct runq *rq;
+
+  pushcli();
+  rq = &runq[cpu()];
+  acquire(&rq->lock);
+  popcli();
+  return rq;
+}
+
+// Release the run queue lock that the scheduler on this CPU
+// handed over when it switched to the current process.
+static void
+unlockrunq(void)
+{
+  release(&runq[cpu()].lock);
+}
+
+// Append p to rq.  Caller holds rq->lock.
+static void
+enqueue(struct runq *rq, struct proc *p)
+{
+  p->next = 0;
+  if(rq->tail)
+    rq->tail->next = p;
+  else
+    rq->head = p;
+  rq->tail = p;
+  rq->n++;
+}
+
+// Remove and return the first process on rq, or 0.
+// Caller holds rq->lock.
+static struct proc*
+dequeue(struct runq *rq)
+{
+  struct proc *p;
+
+  if((p = rq->head) == 0)
+    return 0;
+  rq->head = p->next;
+  if(rq->head == 0)
+    rq->tail = 0;
+  rq->n--;
+  p->next = 0;
+  return p;
+}
+
+// Take a process from another CPU's run queue, or return 0.
+// The process is on no queue when returned, and nothing
+// but a scheduler touches a RUNNABLE process, so the caller
+// can run it once it holds its own queue's lock.
+static struct proc*
+steal(void)
+{
+  int i, me;
+  struct proc *p;
+  struct runq *rq;
+
+  me = cpu();
+  for(i = 1; i < ncpu; i++){
+    rq = &runq[(me + i) % ncpu];
+    if(rq->n == 0)  // unlocked peek; rechecked below
+      continue;
+    acquire(&rq->lock);
+    p = dequeue(rq);
+    release(&rq->lock);
+    if(p)
+      return p;
+  }
+  return 0;
+}
+
+// Make p, which is on no queue, RUNNABLE and put it on
+// the run queue of the CPU it last ran on.  Waits for p to be
+// off that CPU if it is still switching out.  A process being
+// swapped out is queued when swapout is done with it.
+static void
+ready(struct proc *p)
+{
+  struct runq *rq;
+
+  rq = &runq[p->cpu];
+  acquire(&rq->lock);
+  p->state = RUNNABLE;
+  if(!p->swapping)
+    enqueue(rq, p);
+  release(&rq->lock);
+}
+
+// Let the new process p, returned by copyproc, start running.
+void
+setrunnable(struct proc *p)
+{
+  pushcli();
+  p->cpu = cpu();
+  popcli();
+  ready(p);
+}
+
+// Wait until p, which has stopped running, has finished
+// switching out, so that nothing is using its kernel stack.
+// Caller holds proc_table_lock, and p is a ZOMBIE.
+static void
+offcpu(struct proc *p)
+{
+  acquire(&runq[p->cpu].lock);
+  release(&runq[p->cpu].lock);
+}
+
+// Lock and return the run queue of the CPU that p
+// last ran on.  p->cpu only changes under the lock of
+// the CPU taking p, so look again once it is held.
+static struct runq*
+lockprocq(struct proc *p)
+{
+  struct runq *rq;
+
+  for(;;){
+    rq = &runq[p->cpu];
+    acquire(&rq->lock);
+    if(rq == &runq[p->cpu])
+      return rq;
+    release(&rq->lock);
+  }
+}
+
+// Keep the sleeping process p from being queued to run
+// until swapdone, so that its memory can be swapped out.
+// Returns 0 if p is no longer asleep, or has woken and
+// gone back to sleep pinned since the caller looked.
+int
+swapstart(struct proc *p)
+{
+  int ok;
+  struct runq *rq;
+
+  // Holding p's run queue lock also means
+  // p has finished switching out, so pinned
+  // is up to date.
+  rq = lockprocq(p);
+  ok = p->state == SLEEPING && !p->pinned;
+  if(ok)
+    p->swapping = 1;
+  release(&rq->lock);
+  return ok;
+}
+
+// Let p run again after swapstart,
+// queueing it if it was woken meanwhile.
+void
+swapdone(struct proc *p)
+{
+  struct runq *rq;
+
+  rq = lockprocq(p);
+  p->swapping = 0;
+  if(p->state == RUNNABLE)
+    enqueue(rq, p);
+  release(&rq->lock);
+}
+
 // Per-CPU process scheduler.
 // Each CPU calls scheduler() after setting itself up.
 // Scheduler never returns.  It loops, doing:
-//  - choose a process to run
+//  - choose a process to run, from this CPU's run queue
+//    or, if that is empty, another's
 //  - swtch to start running that process
 //  - eventually that process transfers control
 //      via swtch back to the scheduler.
@@ -202,40 +644,45 @@ scheduler(void)
 {
   struct proc *p;
   struct cpu *c;
-  int i;
+  struct runq *rq;
 
   c = &cpus[cpu()];
+  rq = &runq[cpu()];
   for(;;){
     // Enable interrupts on this processor.
     sti();
 
-    // Loop over process table looking for process to run.
-    acquire(&proc_table_lock);
-    for(i = 0; i < NPROC; i++){
-      p = &proc[i];
-      if(p->state != RUNNABLE)
+    acquire(&rq->lock);
+    if((p = dequeue(rq)) == 0){
+      release(&rq->lock);
+      // Nothing queued here: steal, or zero a page for later.
+      if((p = steal()) == 0){
+        kzero();
         continue;
-
-      // Switch to chosen process.  It is the process's job
-      // to release proc_table_lock and then reacquire it
-      // before jumping back to us.
-      c->curproc = p;
-      setupsegs(p);
-      p->state = RUNNING;
-      swtch(&c->context, &p->context);
-
-      // Process is done running for now.
-      // It should have changed its p->state before coming back.
-      c->curproc = 0;
-      setupsegs(0);
+      }
+      acquire(&rq->lock);
     }
-    release(&proc_table_lock);
 
+    // Switch to chosen process.  It is the process's job
+    // to release rq->lock and then reacquire it (as the
+    // lock of whichever CPU it is on) before jumping back.
+    p->cpu = cpu();
+    c->curproc = p;
+    setupsegs(p);
+    p->state = RUNNING;
+    swtch(&c->context, &p->context);
+
+    // Process is done running for now.
+    // It should have changed its p->state before coming back.
+    c->curproc = 0;
+    setupsegs(0);
+    release(&rq->lock);
   }
 }
 
-// Enter scheduler.  Must already hold proc_table_lock
-// and have changed curproc[cpu()]->state.
+// Enter scheduler.  Must hold this CPU's run queue lock
+// (see lockrunq) and no other, and have changed
+// curproc[cpu()]->state.
 void
 sched(void)
 {
@@ -243,8 +690,8 @@ sched(void)
     panic("sched interruptible");
   if(cp->state == RUNNING)
     panic("sched running");
-  if(!holding(&proc_table_lock))
-    panic("sched proc_table_lock");
+  if(!holding(&runq[cpu()].lock))
+    panic("sched runq lock");
   if(cpus[cpu()].ncli != 1)
     panic("sched locks");
 
@@ -255,10 +702,13 @@ sched(void)
 void
 yield(void)
 {
-  acquire(&proc_table_lock);
+  struct runq *rq;
+
+  rq = lockrunq();
   cp->state = RUNNABLE;
+  enqueue(rq, cp);
   sched();
-  release(&proc_table_lock);
+  unlockrunq();
 }
 
 // A fork child's very first scheduling by scheduler()
@@ -266,8 +716,8 @@ yield(void)
 void
 forkret(void)
 {
-  // Still holding proc_table_lock from scheduler.
-  release(&proc_table_lock);
+  // Still holding the run queue lock from scheduler.
+  unlockrunq();
 
   // Jump into assembly, never to return.
   forkret1(cp->tf);
@@ -278,57 +728,89 @@ forkret(void)
 void
 sleep(void *chan, struct spinlock *lk)
 {
+  struct waitq *wq;
+
   if(cp == 0)
     panic("sleep");
 
   if(lk == 0)
     panic("sleep without lk");
 
-  // Must acquire proc_table_lock in order to
-  // change p->state and then call sched.
-  // Once we hold proc_table_lock, we can be
-  // guaranteed that we won't miss any wakeup
-  // (wakeup runs with proc_table_lock locked),
-  // so it's okay to release lk.
-  if(lk != &proc_table_lock){
-    acquire(&proc_table_lock);
-    release(lk);
-  }
-
-  // Go to sleep.
+  // Join chan's wait queue before releasing lk.  Whoever
+  // changes the condition we are waiting for holds lk to do
+  // it, so a wakeup after that will find us on the queue.
+  wq = WAITQ(chan);
+  acquire(&wq->lock);
   cp->chan = chan;
   cp->state = SLEEPING;
+  cp->next = wq->head;
+  wq->head = cp;
+  release(lk);
+
+  // Go to sleep.  A wakeup from here on queues us on this
+  // CPU's run queue, whose lock we hold until we are off it.
+  lockrunq();
+  release(&wq->lock);
   sched();
+  unlockrunq();
 
-  // Tidy up.
-  cp->chan = 0;
+  // Read memory back in if it was swapped out while asleep.
+  if(cp->nswap && !cp->pinned)
+    swapin();
 
   // Reacquire original lock.
-  if(lk != &proc_table_lock){
-    release(&proc_table_lock);
-    acquire(lk);
-  }
+  acquire(lk);
 }
 
-// Wake up all processes sleeping on chan.
-// Proc_table_lock must be held.
+// Take p off wait queue wq and make it runnable.
+// Caller holds wq->lock, and p is on wq.
 static void
-wakeup1(void *chan)
+unsleep(struct waitq *wq, struct proc *p)
 {
-  struct proc *p;
+  struct proc **pp;
 
-  for(p = proc; p < &proc[NPROC]; p++)
-    if(p->state == SLEEPING && p->chan == chan)
-      p->state = RUNNABLE;
+  for(pp = &wq->head; *pp != p; pp = &(*pp)->next)
+    ;
+  *pp = p->next;
+  p->chan = 0;
+  ready(p);
 }
 
 // Wake up all processes sleeping on chan.
 void
 wakeup(void *chan)
 {
-  acquire(&proc_table_lock);
-  wakeup1(chan);
-  release(&proc_table_lock);
+  struct waitq *wq;
+  struct proc *p, *next;
+
+  // Sleepers are on the queue before they release the lock
+  // that the caller changed the condition under (see sleep),
+  // so an empty queue means nobody needs waking.
+  wq = WAITQ(chan);
+  if(wq->head == 0)
+    return;
+  acquire(&wq->lock);
+  for(p = wq->head; p; p = next){
+    next = p->next;
+    if(p->chan == chan)
+      unsleep(wq, p);
+  }
+  release(&wq->lock);
+}
+
+// Wake p if it is asleep, whatever it is sleeping on.
+static void
+wakeproc(struct proc *p)
+{
+  struct waitq *wq;
+
+  // p->chan only changes while p is queued, under the
+  // queue's lock, so check again once it is held.
+  wq = WAITQ(p->chan);
+  acquire(&wq->lock);
+  if(p->state == SLEEPING && WAITQ(p->chan) == wq)
+    unsleep(wq, p);
+  release(&wq->lock);
 }
 
 // Kill the process with the given pid.
@@ -340,12 +822,11 @@ kill(int pid)
   struct proc *p;
 
   acquire(&proc_table_lock);
-  for(p = proc; p < &proc[NPROC]; p++){
+  for(p = pidhash[(uint)pid % NPIDHASH]; p; p = p->pidnext){
     if(p->pid == pid){
       p->killed = 1;
       // Wake process from sleep if necessary.
-      if(p->state == SLEEPING)
-        p->state = RUNNABLE;
+      wakeproc(p);
       release(&proc_table_lock);
       return 0;
     }
@@ -361,7 +842,7 @@ void
 exit(void)
 {
   struct proc *p;
-  int fd;
+  int fd, zombie;
 
   if(cp == initproc)
     panic("init exiting");
@@ -376,24 +857,39 @@ exit(void)
 
   iput(cp->cwd);
   cp->cwd = 0;
+  if(cp->exe){
+    iput(cp->exe);
+    cp->exe = 0;
+  }
+  cp->nseg = 0;
 
   acquire(&proc_table_lock);
 
   // Parent might be sleeping in wait().
-  wakeup1(cp->parent);
+  wakeup(cp->parent);
 
   // Pass abandoned children to init.
-  for(p = proc; p < &proc[NPROC]; p++){
-    if(p->parent == cp){
-      p->parent = initproc;
-      if(p->state == ZOMBIE)
-        wakeup1(initproc);
+  zombie = 0;
+  for(p = cp->children; p; p = p->sibling){
+    p->parent = initproc;
+    if(p->state == ZOMBIE)
+      zombie = 1;
+    if(p->sibling == 0){
+      p->sibling = initproc->children;
+      initproc->children = cp->children;
+      cp->children = 0;
+      break;
     }
   }
+  if(zombie)
+    wakeup(initproc);
 
   // Jump into the scheduler, never to return.
+  // wait frees our stack once we are off this CPU.
   cp->killed = 0;
   cp->state = ZOMBIE;
+  lockrunq();
+  release(&proc_table_lock);
   sched();
   panic("zombie exit");
 }
@@ -404,44 +900,67 @@ int
 wait(void)
 {
   struct proc *p;
-  int i, havekids, pid;
+  int pid;
 
   acquire(&proc_table_lock);
   for(;;){
-    // Scan through table looking for zombie children.
-    havekids = 0;
-    for(i = 0; i < NPROC; i++){
-      p = &proc[i];
-      if(p->state == UNUSED)
-        continue;
-      if(p->parent == cp){
-        if(p->state == ZOMBIE){
-          // Found one.
-          kfree(p->mem, p->sz);
-          kfree(p->kstack, KSTACKSIZE);
-          pid = p->pid;
-          p->state = UNUSED;
-          p->pid = 0;
-          p->parent = 0;
-          p->name[0] = 0;
-          release(&proc_table_lock);
-          return pid;
-        }
-        havekids = 1;
+    // Look through our children for a zombie.
+    for(p = cp->children; p; p = p->sibling){
+      if(p->state == ZOMBIE){
+        // Found one.
+        offcpu(p);
+        freevm(p->pgdir);
+        p->pgdir = 0;
+        pid = p->pid;
+        unlinkproc(p);
+        release(&proc_table_lock);
+        return pid;
       }
     }
 
     // No point waiting if we don't have any children.
-    if(!havekids || cp->killed){
+    if(cp->children == 0 || cp->killed){
       release(&proc_table_lock);
       return -1;
     }
 
-    // Wait for children to exit.  (See wakeup1 call in proc_exit.)
+    // Wait for children to exit.  (See wakeup call in exit.)
     sleep(cp, &proc_table_lock);
   }
 }
 
+// Fill in *pm with the memory of the first process, in pid
+// order, whose pid is greater than pid.  Returns its pid,
+// or 0 if there is none.
+int
+procmem(int pid, struct procmem *pm)
+{
+  struct proc *p;
+
+  // Holding proc_table_lock keeps exec and wait
+  // from freeing the page directory under us.
+  acquire(&proc_table_lock);
+  // Start after pid itself if it is still there.
+  for(p = pidhash[(uint)pid % NPIDHASH]; p; p = p->pidnext)
+    if(p->pid == pid)
+      break;
+  p = p ? p->allnext : allproc;
+  for(; p; p = p->allnext)
+    if(p->pid > pid && p->state != EMBRYO && p->pgdir)
+      break;
+  if(p == 0){
+    release(&proc_table_lock);
+    return 0;
+  }
+  pm->pid = p->pid;
+  safestrcpy(pm->name, p->name, sizeof(pm->name));
+  pm->sz = p->sz;
+  pm->rss = countuvm(p->pgdir, p->sz);
+  pm->nswap = p->nswap;
+  release(&proc_table_lock);
+  return pm->pid;
+}
+
 // Print a process listing to console.  For debugging.
 // Runs when user types ^P on console.
 // No lock to avoid wedging a stuck machine further.
@@ -456,15 +975,12 @@ procdump(void)
   [RUNNING]   "run   ",
   [ZOMBIE]    "zombie"
   };
-  int i, j;
+  int j;
   struct proc *p;
   char *state;
   uint pc[10];
   
-  for(i = 0; i < NPROC; i++){
-    p = &proc[i];
-    if(p->state == UNUSED)
-      continue;
+  for(p = allproc; p; p = p->allnext){
     if(p->state >= 0 && p->state < NELEM(states) && states[p->state])
       state = states[p->state];
     else
@@ -24,20 +24,41 @@ struct context {
   int ebp;
 };
 
+// A program segment, paged in from the program file.
+// Memory beyond filesz is zero-filled.
+struct vseg {
+  uint va;      // user address of start
+  uint off;     // offset in the program file
+  uint filesz;  // bytes to read from the file
+};
+
 enum proc_state { UNUSED, EMBRYO, SLEEPING, RUNNABLE, RUNNING, ZOMBIE };
 
 // Per-process state
 struct proc {
-  char *mem;                // Start of process memory (kernel address)
+  pde_t *pgdir;             // Page directory mapping process memory
   uint sz;                  // Size of process memory (bytes)
   char *kstack;             // Bottom of kernel stack for this process
   enum proc_state state;    // Process state
+  struct proc *next;        // Next on run, wait or unused queue
+  int cpu;                  // CPU whose run queue holds it
   int pid;                  // Process ID
   struct proc *parent;      // Parent process
+  struct proc *children;    // First child
+  struct proc *sibling;     // Next child of parent
+  struct proc *pidnext;     // Next in pid hash chain
+  struct proc *allnext;     // Next on list of all processes
+  struct proc *allprev;     // Previous on list of all processes
   void *chan;               // If non-zero, sleeping on chan
   int killed;               // If non-zero, have been killed
+  int pinned;               // If non-zero, memory is in use: don't swap out
+  int swapping;             // If non-zero, being swapped out: don't run
+  int nswap;                // Number of pages swapped out
   struct file *ofile[NOFILE];  // Open files
   struct inode *cwd;        // Current directory
+  struct inode *exe;        // Program file, for paging in
+  struct vseg seg[NSEG];    // Program segments in exe
+  int nseg;                 // Number of segments in seg
   struct context context;   // Switch here to run process
   struct trapframe *tf;     // Trap frame for current interrupt
   char name[16];            // Process name (debugging)
@@ -48,6 +69,7 @@ struct proc {
 //   original data and bss
 //   fixed-size stack
 //   expandable heap
+// It is mapped page by page at linear address USERBASE (see vm.c).
 
 // Per-CPU state
 struct cpu {
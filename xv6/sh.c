@@ -3,6 +3,8 @@
 #include "types.h"
 #include "user.h"
 #include "fcntl.h"
+#include "param.h"
+#include "spawn.h"
 
 // Parsed command representation
 #define EXEC  1
@@ -130,6 +132,135 @@ runcmd(struct cmd *cmd)
   exit();
 }
 
+// Free cmd, as allocated by parsecmd.
+void
+freecmd(struct cmd *cmd)
+{
+  struct backcmd *bcmd;
+  struct listcmd *lcmd;
+  struct pipecmd *pcmd;
+
+  if(cmd == 0)
+    return;
+  switch(cmd->type){
+  case REDIR:
+    freecmd(((struct redircmd*)cmd)->cmd);
+    break;
+  case PIPE:
+    pcmd = (struct pipecmd*)cmd;
+    freecmd(pcmd->left);
+    freecmd(pcmd->right);
+    break;
+  case LIST:
+    lcmd = (struct listcmd*)cmd;
+    freecmd(lcmd->left);
+    freecmd(lcmd->right);
+    break;
+  case BACK:
+    bcmd = (struct backcmd*)cmd;
+    freecmd(bcmd->cmd);
+    break;
+  }
+  free(cmd);
+}
+
+// Can cmd be run with spawn alone: a command
+// with redirections, or a pipeline of them?
+int
+spawnable(struct cmd *cmd)
+{
+  struct pipecmd *pcmd;
+
+  switch(cmd->type){
+  case EXEC:
+    return 1;
+  case REDIR:
+    return spawnable(((struct redircmd*)cmd)->cmd);
+  case PIPE:
+    pcmd = (struct pipecmd*)cmd;
+    return spawnable(pcmd->left) && spawnable(pcmd->right);
+  }
+  return 0;
+}
+
+// Add a file action for the children of spawncmd.
+// The caller checks that there is room.
+int
+addact(struct spawnact *act, int nact, int op, int fd, int src)
+{
+  act[nact].op = op;
+  act[nact].fd = fd;
+  act[nact].src = src;
+  return nact + 1;
+}
+
+// Start the commands in spawnable cmd with spawn,
+// applying the nact file actions in act first.
+// The shell opens files and pipes itself, hands them
+// to the children, and closes them again.
+// Commands that cannot be set up are reported and skipped.
+// Returns the number of children started.
+int
+spawncmd(struct cmd *cmd, struct spawnact *act, int nact)
+{
+  int fd, m, n, p[2];
+  struct execcmd *ecmd;
+  struct pipecmd *pcmd;
+  struct redircmd *rcmd;
+
+  switch(cmd->type){
+  case EXEC:
+    ecmd = (struct execcmd*)cmd;
+    if(ecmd->argv[0] == 0)
+      return 0;
+    if(spawn(ecmd->argv[0], ecmd->argv, act, nact) < 0){
+      printf(2, "exec %s failed\n", ecmd->argv[0]);
+      return 0;
+    }
+    return 1;
+
+  case REDIR:
+    rcmd = (struct redircmd*)cmd;
+    if(nact + 2 > NSPAWNACT){
+      printf(2, "too many redirections\n");
+      return 0;
+    }
+    if((fd = open(rcmd->file, rcmd->mode)) < 0){
+      printf(2, "open %s failed\n", rcmd->file);
+      return 0;
+    }
+    nact = addact(act, nact, SPAWN_DUP, rcmd->fd, fd);
+    nact = addact(act, nact, SPAWN_CLOSE, fd, 0);
+    n = spawncmd(rcmd->cmd, act, nact);
+    close(fd);
+    return n;
+
+  case PIPE:
+    pcmd = (struct pipecmd*)cmd;
+    if(nact + 3 > NSPAWNACT){
+      printf(2, "too many redirections\n");
+      return 0;
+    }
+    if(pipe(p) < 0){
+      printf(2, "pipe failed\n");
+      return 0;
+    }
+    m = addact(act, nact, SPAWN_DUP, 1, p[1]);
+    m = addact(act, m, SPAWN_CLOSE, p[0], 0);
+    m = addact(act, m, SPAWN_CLOSE, p[1], 0);
+    n = spawncmd(pcmd->left, act, m);
+    m = addact(act, nact, SPAWN_DUP, 0, p[0]);
+    m = addact(act, m, SPAWN_CLOSE, p[0], 0);
+    m = addact(act, m, SPAWN_CLOSE, p[1], 0);
+    n += spawncmd(pcmd->right, act, m);
+    close(p[0]);
+    close(p[1]);
+    return n;
+  }
+  panic("spawncmd");
+  return 0;
+}
+
 int
 getcmd(char *buf, int nbuf)
 {
@@ -145,7 +276,9 @@ int
 main(void)
 {
   static char buf[100];
-  int fd;
+  static struct spawnact act[NSPAWNACT];
+  int fd, n;
+  struct cmd *cmd;
   
   // Assumes three file descriptors open.
   while((fd = open("console", O_RDWR)) >= 0){
@@ -165,9 +298,18 @@ main(void)
         printf(2, "cannot cd %s\n", buf+3);
       continue;
     }
-    if(fork1() == 0)
-      runcmd(parsecmd(buf));
-    wait();
+    // Simple commands and pipelines are started
+    // directly; anything else runs in a forked shell.
+    cmd = parsecmd(buf);
+    if(cmd && spawnable(cmd)){
+      for(n = spawncmd(cmd, act, 0); n > 0; n--)
+        wait();
+    } else {
+      if(fork1() == 0)
+        runcmd(cmd);
+      wait();
+    }
+    freecmd(cmd);
   }
   exit();
 }
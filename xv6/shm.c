@@ -0,0 +1,84 @@
+// Shared memory.
+//
+// shmcreate makes an object of zeroed pages and returns a file
+// descriptor for it.  mmap of the descriptor attaches the pages,
+// writable, to the calling process, and munmap detaches them;
+// processes that share the descriptor, through fork or spawn,
+// can attach the same pages and exchange data through them
+// without system calls.  The pages are marked PTE_SHARED, so
+// fork shares them with the child instead of copying on write.
+// Since they can change under the kernel at any time, strings
+// in them are not accepted as system call arguments (see fetchstr).
+//
+// The object holds one reference to each page and every
+// mapping holds another, so the pages last until the
+// descriptor is closed and the last mapping is gone.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "file.h"
+#include "meminfo.h"
+
+struct shm {
+  uint npage;     // number of pages
+  char *page[];   // the pages
+};
+
+// An object and its page list fill one page.
+#define SHMMAX ((PAGE - sizeof(struct shm)) / sizeof(char*))
+
+// Allocate a shared memory object of n bytes, zeroed,
+// and a file *f for it.
+int
+shmalloc(struct file **f, uint n)
+{
+  uint i;
+  struct shm *s;
+
+  *f = 0;
+  if(n == 0 || n > SHMMAX*PAGE)
+    return -1;
+  if((s = (struct shm*)kalloc(PAGE, KM_SHM)) == 0)
+    return -1;
+  s->npage = 0;
+  for(i = 0; i < (n + PAGE - 1) / PAGE; i++){
+    if((s->page[i] = kzalloc(KM_SHM)) == 0)
+      goto bad;
+    s->npage++;
+  }
+  if((*f = filealloc()) == 0)
+    goto bad;
+  // No read or write: the data is reached through mmap.
+  (*f)->type = FD_SHM;
+  (*f)->readable = 0;
+  (*f)->writable = 0;
+  (*f)->shm = s;
+  return 0;
+
+ bad:
+  shmclose(s);
+  return -1;
+}
+
+// Drop the object's references to its pages, and free it.
+void
+shmclose(struct shm *s)
+{
+  uint i;
+
+  for(i = 0; i < s->npage; i++)
+    kfree(s->page[i], PAGE);
+  kfree((char*)s, PAGE);
+}
+
+// Map the n bytes of s from page-aligned offset off at
+// page-aligned user address va in pgdir.
+// Returns 0, or -1 with nothing mapped.
+int
+shmmap(struct shm *s, pde_t *pgdir, uint va, uint off, uint n)
+{
+  if(off % PAGE || off + n < off || off + n > s->npage*PAGE)
+    return -1;
+  return mapshared(pgdir, va, s->page + off/PAGE, (n + PAGE - 1) / PAGE);
+}
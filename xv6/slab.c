@@ -0,0 +1,175 @@
+// Slab allocator for small kernel objects.
+//
+// Each slabcache hands out objects of one size.  It takes
+// whole pages from kalloc, one at a time, and divides each
+// into a small header and as many objects as fit.  The free
+// objects of a slab are linked through their first word, and
+// slabs with free objects are on the cache's partial list.
+// An object's slab is found by rounding its address down to
+// the page, so freeing takes constant time.  A slab whose
+// objects are all free goes back to kalloc.
+//
+// As with single pages in kalloc.c, each CPU keeps a few free
+// objects of every cache, moved to and from the slabs
+// SLABBATCH at a time, so the cache lock is taken only once
+// per batch.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "spinlock.h"
+#include "slab.h"
+#include "meminfo.h"
+
+struct slab {
+  struct slab *next;  // on the partial list
+  struct slab *prev;
+  void *free;         // first free object
+  uint nfree;         // number of free objects
+};
+
+// Objects follow the header, word-aligned.
+#define SLABHDR ((sizeof(struct slab) + 3) & ~3)
+
+// Initialize c to allocate objects of size bytes.
+void
+slabinit(struct slabcache *c, char *name, uint size)
+{
+  int i;
+
+  size = (size + 3) & ~3;
+  if(size < sizeof(void*) || size > PAGE - SLABHDR)
+    panic("slabinit");
+  c->name = name;
+  c->size = size;
+  c->perslab = (PAGE - SLABHDR) / size;
+  c->partial = 0;
+  initlock(&c->lock, name);
+  for(i = 0; i < NCPU; i++){
+    initlock(&c->cpu[i].lock, name);
+    c->cpu[i].n = 0;
+  }
+}
+
+// Carve a new page into a slab of free objects
+// and put it on the partial list.
+// Caller must hold c->lock.
+static struct slab*
+slabgrow(struct slabcache *c)
+{
+  int i;
+  char *o;
+  struct slab *s;
+
+  if((s = (struct slab*)kalloc(PAGE, KM_SLAB)) == 0)
+    return 0;
+  s->free = 0;
+  for(i = c->perslab-1; i >= 0; i--){
+    o = (char*)s + SLABHDR + i*c->size;
+    *(void**)o = s->free;
+    s->free = o;
+  }
+  s->nfree = c->perslab;
+  s->prev = 0;
+  s->next = c->partial;
+  if(s->next)
+    s->next->prev = s;
+  c->partial = s;
+  return s;
+}
+
+static void
+unlinkslab(struct slabcache *c, struct slab *s)
+{
+  if(s->prev)
+    s->prev->next = s->next;
+  else
+    c->partial = s->next;
+  if(s->next)
+    s->next->prev = s->prev;
+}
+
+// Take a free object from the slabs.
+// Caller must hold c->lock.
+static void*
+getobj(struct slabcache *c)
+{
+  void *o;
+  struct slab *s;
+
+  if((s = c->partial) == 0 && (s = slabgrow(c)) == 0)
+    return 0;
+  o = s->free;
+  s->free = *(void**)o;
+  if(--s->nfree == 0)
+    unlinkslab(c, s);
+  return o;
+}
+
+// Return object o to its slab.
+// Caller must hold c->lock.
+static void
+putobj(struct slabcache *c, void *o)
+{
+  struct slab *s;
+
+  s = (struct slab*)((uint)o & ~(PAGE-1));
+  *(void**)o = s->free;
+  s->free = o;
+  if(s->nfree++ == 0){
+    s->prev = 0;
+    s->next = c->partial;
+    if(s->next)
+      s->next->prev = s;
+    c->partial = s;
+  }
+  if(s->nfree == c->perslab){
+    unlinkslab(c, s);
+    kfree((char*)s, PAGE);
+  }
+}
+
+// Allocate an object from c.
+// Returns 0 if there is no memory.
+void*
+slaballoc(struct slabcache *c)
+{
+  void *o;
+  int id;
+
+  pushcli();
+  id = cpu();
+  acquire(&c->cpu[id].lock);
+  popcli();
+  if(c->cpu[id].n == 0){
+    acquire(&c->lock);
+    while(c->cpu[id].n < SLABBATCH && (o = getobj(c)) != 0)
+      c->cpu[id].obj[c->cpu[id].n++] = o;
+    release(&c->lock);
+  }
+  o = 0;
+  if(c->cpu[id].n > 0)
+    o = c->cpu[id].obj[--c->cpu[id].n];
+  release(&c->cpu[id].lock);
+  return o;
+}
+
+// Free object o, allocated from c.
+void
+slabfree(struct slabcache *c, void *o)
+{
+  int id;
+
+  pushcli();
+  id = cpu();
+  acquire(&c->cpu[id].lock);
+  popcli();
+  if(c->cpu[id].n == NELEM(c->cpu[id].obj)){
+    acquire(&c->lock);
+    while(c->cpu[id].n > SLABBATCH)
+      putobj(c, c->cpu[id].obj[--c->cpu[id].n]);
+    release(&c->lock);
+  }
+  c->cpu[id].obj[c->cpu[id].n++] = o;
+  release(&c->cpu[id].lock);
+}
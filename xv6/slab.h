@@ -0,0 +1,19 @@
+// A cache of equal-sized kernel objects, carved out of
+// whole pages (slabs).  See slab.c.
+
+#define SLABBATCH 8  // objects moved between a CPU cache and the slabs
+
+struct slab;
+
+struct slabcache {
+  char *name;
+  uint size;             // bytes per object
+  uint perslab;          // objects per slab
+  struct spinlock lock;  // protects the slab list
+  struct slab *partial;  // slabs with some objects free
+  struct {
+    struct spinlock lock;
+    int n;                   // number of objects in obj[]
+    void *obj[2*SLABBATCH];  // free objects
+  } cpu[NCPU];           // free objects cached by each CPU
+};
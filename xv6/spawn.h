@@ -0,0 +1,10 @@
+// File descriptor actions for spawn, applied in order
+// to the child's copy of the parent's open files.
+#define SPAWN_DUP   1  // make fd a duplicate of src
+#define SPAWN_CLOSE 2  // close fd
+
+struct spawnact {
+  int op;   // SPAWN_DUP or SPAWN_CLOSE
+  int fd;   // child's file descriptor
+  int src;  // for SPAWN_DUP, descriptor to duplicate
+};
@@ -5,3 +5,12 @@ struct stat {
   short nlink; // Number of links to file
   uint size;   // Size of file in bytes
 };
+
+// Directory entry together with the metadata of the inode
+// it names, as returned by getdents(fd, buf, n, 1).
+// The first two fields have the layout of struct dirent.
+struct dirstat {
+  ushort inum;   // Inode number
+  char name[14]; // Entry name (DIRSIZ bytes)
+  struct stat st;
+};
@@ -0,0 +1,175 @@
+// Swapping.
+//
+// When user memory runs out, swapout picks a sleeping process
+// and writes its private pages to the swap area, the nswap
+// blocks that follow the file system on ROOTDEV, and frees them.
+// The page table entry of a swapped page holds its slot number
+// and PTE_SWAP instead of PTE_P (see swapoutuvm in vm.c).
+//
+// A swapped-out process stays on the process table as usual.
+// When it wakes up, sleep calls swapin to read all of its
+// pages back before it goes any further, so the rest of the
+// kernel never finds its memory missing.  A process whose
+// memory another process may be using, such as a pipe reader
+// offering its buffers to writers, is pinned and never chosen.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "proc.h"
+#include "spinlock.h"
+#include "buf.h"
+#include "fs.h"
+
+#define SWAPB (PAGE/BSIZE)  // blocks per slot
+
+extern struct spinlock proc_table_lock;
+extern struct proc *allproc;
+
+struct {
+  struct spinlock lock;
+  int init;          // start and nslot are set
+  uint start;        // first block of swap area
+  uint nslot;        // number of slots in use
+  uchar used[NSWAP]; // slot is holding a page
+} swap;
+
+void
+swapinit(void)
+{
+  initlock(&swap.lock, "swap");
+}
+
+// Find the swap area, the first time.
+// Reads the superblock, so may sleep.
+static void
+swapfind(void)
+{
+  struct superblock sb;
+
+  if(swap.init)
+    return;
+  readsb(ROOTDEV, &sb);
+  acquire(&swap.lock);
+  swap.start = sb.size;
+  swap.nslot = sb.nswap / SWAPB;
+  if(swap.nslot > NSWAP)
+    swap.nslot = NSWAP;
+  swap.init = 1;
+  release(&swap.lock);
+}
+
+// Write the page at pa to a free swap slot.
+// Returns the slot, or -1 if the swap area is full.
+int
+swapwrite(char *pa)
+{
+  int i, slot;
+  struct buf *bp;
+
+  swapfind();
+  acquire(&swap.lock);
+  for(slot = 0; slot < swap.nslot; slot++)
+    if(!swap.used[slot])
+      break;
+  if(slot == swap.nslot){
+    release(&swap.lock);
+    return -1;
+  }
+  swap.used[slot] = 1;
+  release(&swap.lock);
+
+  for(i = 0; i < SWAPB; i++){
+    bp = bread(ROOTDEV, swap.start + slot*SWAPB + i);
+    memmove(bp->data, pa + i*BSIZE, BSIZE);
+    bwrite(bp);
+    brelse(bp);
+  }
+  return slot;
+}
+
+// Read the page in swap slot slot into pa, and free the slot.
+void
+swapread(int slot, char *pa)
+{
+  int i;
+  struct buf *bp;
+
+  for(i = 0; i < SWAPB; i++){
+    bp = bread(ROOTDEV, swap.start + slot*SWAPB + i);
+    memmove(pa + i*BSIZE, bp->data, BSIZE);
+    brelse(bp);
+  }
+  swapfree(slot);
+}
+
+// Free swap slot slot without reading it.
+void
+swapfree(int slot)
+{
+  acquire(&swap.lock);
+  if(slot >= swap.nslot || !swap.used[slot])
+    panic("swapfree");
+  swap.used[slot] = 0;
+  release(&swap.lock);
+}
+
+// Swap out the largest sleeping process that is
+// not pinned or swapped out already, to free memory.
+// May sleep.
+// Returns the number of pages freed.
+int
+swapout(void)
+{
+  int n;
+  struct proc *p, *q;
+
+  acquire(&proc_table_lock);
+  do {
+    q = 0;
+    for(p = allproc; p; p = p->allnext){
+      if(p->state != SLEEPING || p->pinned || p->swapping || p->nswap)
+        continue;
+      if(q == 0 || p->sz > q->sz)
+        q = p;
+    }
+    // Keep q from running until its page table is
+    // consistent; choose again if it has just woken up.
+  } while(q && !swapstart(q));
+  release(&proc_table_lock);
+  if(q == 0)
+    return 0;
+
+  n = swapoutuvm(q->pgdir, q->sz);
+
+  acquire(&proc_table_lock);
+  q->nswap += n;
+  release(&proc_table_lock);
+  swapdone(q);
+  return n;
+}
+
+// Read back all of the current process's swapped-out pages.
+// Called by sleep, without locks held.  Waits, swapping out
+// other processes if need be, until there is memory for them.
+void
+swapin(void)
+{
+  int n;
+
+  acquire(&proc_table_lock);
+  cp->pinned++;
+  release(&proc_table_lock);
+
+  while((n = swapinuvm(cp->pgdir, cp->sz)) < cp->nswap){
+    cp->nswap -= n;
+    if(swapout() == 0)
+      yield();
+  }
+  cp->nswap = 0;
+
+  acquire(&proc_table_lock);
+  cp->pinned--;
+  release(&proc_table_lock);
+}
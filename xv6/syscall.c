@@ -12,31 +12,65 @@
 // library system call function. The saved user %esp points
 // to a saved program counter, and then the first argument.
 
+// The kernel sees the memory of the current process
+// at linear address USERBASE, so p must be cp.
+
+// Page in any pages of p's memory in [addr, addr+n)
+// that are not there yet, so that the kernel can use
+// them without faulting (see vm.c).  If the kernel is
+// going to write to them, write is set, and p is given
+// its own copy of any copy-on-write pages among them.
+// Returns 0, or -1 if they cannot be paged in or copied.
+int
+prefault(struct proc *p, uint addr, uint n, int write)
+{
+  uint a;
+
+  for(a = PGROUNDDOWN(addr); a < addr + n; a += PAGE){
+    if(pagein(p->pgdir, a, p->exe, p->seg, p->nseg) < 0)
+      return -1;
+    if(write && cowbreak(p->pgdir, a) < 0)
+      return -1;
+  }
+  return 0;
+}
+
 // Fetch the int at addr from process p.
 int
 fetchint(struct proc *p, uint addr, int *ip)
 {
   if(addr >= p->sz || addr+4 > p->sz)
     return -1;
-  *ip = *(int*)(p->mem + addr);
+  if(prefault(p, addr, 4, 0) < 0)
+    return -1;
+  *ip = *(int*)(USERBASE + addr);
   return 0;
 }
 
 // Fetch the nul-terminated string at addr from process p.
 // Doesn't actually copy the string - just sets *pp to point at it.
+// So that the string cannot change while the kernel uses it,
+// it must not lie in shared memory (see shm.c).
 // Returns length of string, not including nul.
 int
 fetchstr(struct proc *p, uint addr, char **pp)
 {
   char *s, *ep;
+  uint a;
 
   if(addr >= p->sz)
     return -1;
-  *pp = p->mem + addr;
-  ep = p->mem + p->sz;
-  for(s = *pp; s < ep; s++)
+  *pp = (char*)USERBASE + addr;
+  ep = (char*)USERBASE + p->sz;
+  for(s = *pp; s < ep; s++){
+    a = s - (char*)USERBASE;
+    if(s == *pp || a % PAGE == 0){
+      if(prefault(p, a, 1, 0) < 0 || uvmshared(p->pgdir, a))
+        return -1;
+    }
     if(*s == 0)
       return s - *pp;
+  }
   return -1;
 }
 
@@ -47,11 +81,8 @@ argint(int n, int *ip)
   return fetchint(cp, cp->tf->esp + 4 + 4*n, ip);
 }
 
-// Fetch the nth word-sized system call argument as a pointer
-// to a block of memory of size n bytes.  Check that the pointer
-// lies within the process address space.
-int
-argptr(int n, char **pp, int size)
+static int
+argbuf(int n, char **pp, int size, int write)
 {
   int i;
   
@@ -59,14 +90,34 @@ argptr(int n, char **pp, int size)
     return -1;
   if((uint)i >= cp->sz || (uint)i+size >= cp->sz)
     return -1;
-  *pp = cp->mem + i;
+  if(prefault(cp, i, size, write) < 0)
+    return -1;
+  *pp = (char*)USERBASE + i;
   return 0;
 }
 
+// Fetch the nth word-sized system call argument as a pointer
+// to a block of memory of size n bytes.  Check that the pointer
+// lies within the process address space.
+int
+argptr(int n, char **pp, int size)
+{
+  return argbuf(n, pp, size, 0);
+}
+
+// Like argptr, for a block of memory the system call
+// will write to.
+int
+argwptr(int n, char **pp, int size)
+{
+  return argbuf(n, pp, size, 1);
+}
+
 // Fetch the nth word-sized system call argument as a string pointer.
 // Check that the pointer is valid and the string is nul-terminated.
-// (There is no shared writable memory, so the string can't change
-// between this check and being used by the kernel.)
+// (fetchstr refuses strings in shared memory, the only memory other
+// processes can write, so the string can't change between this check
+// and being used by the kernel.)
 int
 argstr(int n, char **pp)
 {
@@ -78,46 +129,70 @@ argstr(int n, char **pp)
 
 extern int sys_chdir(void);
 extern int sys_close(void);
+extern int sys_copy_file_range(void);
 extern int sys_dup(void);
 extern int sys_exec(void);
 extern int sys_exit(void);
 extern int sys_fork(void);
 extern int sys_fstat(void);
+extern int sys_getdents(void);
 extern int sys_getpid(void);
 extern int sys_kill(void);
 extern int sys_link(void);
+extern int sys_meminfo(void);
 extern int sys_mkdir(void);
 extern int sys_mknod(void);
+extern int sys_mmap(void);
+extern int sys_munmap(void);
 extern int sys_open(void);
 extern int sys_pipe(void);
+extern int sys_pread(void);
+extern int sys_pwrite(void);
 extern int sys_read(void);
+extern int sys_readv(void);
 extern int sys_sbrk(void);
+extern int sys_shmcreate(void);
 extern int sys_sleep(void);
+extern int sys_spawn(void);
+extern int sys_splice(void);
 extern int sys_unlink(void);
 extern int sys_wait(void);
 extern int sys_write(void);
+extern int sys_writev(void);
 
 static int (*syscalls[])(void) = {
 [SYS_chdir]   sys_chdir,
 [SYS_close]   sys_close,
+[SYS_copy_file_range] sys_copy_file_range,
 [SYS_dup]     sys_dup,
 [SYS_exec]    sys_exec,
 [SYS_exit]    sys_exit,
 [SYS_fork]    sys_fork,
 [SYS_fstat]   sys_fstat,
+[SYS_getdents] sys_getdents,
 [SYS_getpid]  sys_getpid,
 [SYS_kill]    sys_kill,
 [SYS_link]    sys_link,
+[SYS_meminfo] sys_meminfo,
 [SYS_mkdir]   sys_mkdir,
 [SYS_mknod]   sys_mknod,
+[SYS_mmap]    sys_mmap,
+[SYS_munmap]  sys_munmap,
 [SYS_open]    sys_open,
 [SYS_pipe]    sys_pipe,
+[SYS_pread]   sys_pread,
+[SYS_pwrite]  sys_pwrite,
 [SYS_read]    sys_read,
+[SYS_readv]   sys_readv,
 [SYS_sbrk]    sys_sbrk,
+[SYS_shmcreate] sys_shmcreate,
 [SYS_sleep]   sys_sleep,
+[SYS_spawn]   sys_spawn,
+[SYS_splice]  sys_splice,
 [SYS_unlink]  sys_unlink,
 [SYS_wait]    sys_wait,
 [SYS_write]   sys_write,
+[SYS_writev]  sys_writev,
 };
 
 void
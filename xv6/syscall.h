@@ -19,3 +19,15 @@
 #define SYS_getpid 18
 #define SYS_sbrk   19
 #define SYS_sleep  20
+#define SYS_pread  21
+#define SYS_pwrite 22
+#define SYS_readv  23
+#define SYS_writev 24
+#define SYS_getdents 25
+#define SYS_copy_file_range 26
+#define SYS_splice 27
+#define SYS_spawn  28
+#define SYS_mmap   29
+#define SYS_munmap 30
+#define SYS_shmcreate 31
+#define SYS_meminfo 32
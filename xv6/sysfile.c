@@ -8,6 +8,8 @@
 #include "fsvar.h"
 #include "file.h"
 #include "fcntl.h"
+#include "uio.h"
+#include "spawn.h"
 
 // Fetch the nth word-sized system call argument as a file descriptor
 // and return both the descriptor and the corresponding struct file.
@@ -51,7 +53,7 @@ sys_read(void)
   int n;
   char *p;
 
-  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0)
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argwptr(1, &p, n) < 0)
     return -1;
   return fileread(f, p, n);
 }
@@ -68,6 +70,142 @@ sys_write(void)
   return filewrite(f, p, n);
 }
 
+int
+sys_pread(void)
+{
+  struct file *f;
+  int n, off;
+  char *p;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argwptr(1, &p, n) < 0 ||
+     argint(3, &off) < 0 || off < 0)
+    return -1;
+  return filepread(f, p, n, off);
+}
+
+int
+sys_mmap(void)
+{
+  struct file *f;
+  int off, n;
+
+  if(argfd(0, 0, &f) < 0 || argint(1, &off) < 0 || argint(2, &n) < 0 ||
+     off < 0 || n < 0)
+    return -1;
+  return mmap(f, off, n);
+}
+
+int
+sys_pwrite(void)
+{
+  struct file *f;
+  int n, off;
+  char *p;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || argptr(1, &p, n) < 0 ||
+     argint(3, &off) < 0 || off < 0)
+    return -1;
+  return filepwrite(f, p, n, off);
+}
+
+// Fetch the nth word-sized system call argument as a pointer
+// to an array of iovecs, and the next argument as its length.
+// Check that every buffer lies within the process address space
+// and copy the vector into kiov, translated to the addresses
+// where the kernel sees them (see fetchint).  If write is set,
+// the buffers are prepared for the kernel to write to (see prefault).
+// Returns the number of iovecs.
+static int
+argiov(int n, struct iovec *kiov, int write)
+{
+  int i, cnt;
+  uint base;
+  struct iovec *iov;
+
+  if(argint(n+1, &cnt) < 0 || cnt < 0 || cnt > NIOV)
+    return -1;
+  if(argptr(n, (void*)&iov, cnt*sizeof(iov[0])) < 0)
+    return -1;
+  for(i = 0; i < cnt; i++){
+    base = (uint)iov[i].base;
+    if(iov[i].len < 0 || base >= cp->sz || base+iov[i].len >= cp->sz)
+      return -1;
+    if(prefault(cp, base, iov[i].len, write) < 0)
+      return -1;
+    kiov[i].base = (char*)USERBASE + base;
+    kiov[i].len = iov[i].len;
+  }
+  return cnt;
+}
+
+int
+sys_readv(void)
+{
+  struct file *f;
+  struct iovec iov[NIOV];
+  int cnt;
+
+  if(argfd(0, 0, &f) < 0 || (cnt = argiov(1, iov, 1)) < 0)
+    return -1;
+  return filereadv(f, iov, cnt);
+}
+
+int
+sys_writev(void)
+{
+  struct file *f;
+  struct iovec iov[NIOV];
+  int cnt;
+
+  if(argfd(0, 0, &f) < 0 || (cnt = argiov(1, iov, 0)) < 0)
+    return -1;
+  return filewritev(f, iov, cnt);
+}
+
+// Read as many directory entries as fit in the buffer.
+// If the fourth argument is non-zero, return struct dirstat
+// records carrying each entry's metadata instead of plain
+// struct dirent, saving the caller a stat per entry.
+int
+sys_getdents(void)
+{
+  struct file *f;
+  int n, withstat;
+  char *p;
+
+  if(argfd(0, 0, &f) < 0 || argint(2, &n) < 0 || n < 0 ||
+     argwptr(1, &p, n) < 0 || argint(3, &withstat) < 0)
+    return -1;
+  return filegetdents(f, p, n, withstat);
+}
+
+// Copy bytes from one file to another inside the kernel.
+// Whole blocks are shared between the files rather than copied.
+int
+sys_copy_file_range(void)
+{
+  struct file *in, *out;
+  int n;
+
+  if(argfd(0, 0, &in) < 0 || argfd(1, 0, &out) < 0 || argint(2, &n) < 0 || n < 0)
+    return -1;
+  return filecopy(in, out, n);
+}
+
+// Move bytes from one file to another inside the kernel,
+// e.g. from a file to a pipe or the console, or from a pipe
+// to a file.  Covers what other systems call sendfile.
+int
+sys_splice(void)
+{
+  struct file *in, *out;
+  int n;
+
+  if(argfd(0, 0, &in) < 0 || argfd(1, 0, &out) < 0 || argint(2, &n) < 0 || n < 0)
+    return -1;
+  return filesplice(in, out, n);
+}
+
 int
 sys_dup(void)
 {
@@ -101,7 +239,7 @@ sys_fstat(void)
   struct file *f;
   struct stat *st;
   
-  if(argfd(0, 0, &f) < 0 || argptr(1, (void*)&st, sizeof(*st)) < 0)
+  if(argfd(0, 0, &f) < 0 || argwptr(1, (void*)&st, sizeof(*st)) < 0)
     return -1;
   return filestat(f, st);
 }
@@ -307,6 +445,7 @@ sys_mknod(void)
   if((len=argstr(0, &path)) < 0 ||
      argint(1, &major) < 0 ||
      argint(2, &minor) < 0 ||
+     major < 0 || major > 0xff || minor < 0 || minor > 0xff ||
      (ip = create(path, 0, T_DEV, major, minor)) == 0)
     return -1;
   iunlockput(ip);
@@ -344,18 +483,20 @@ sys_chdir(void)
   return 0;
 }
 
-int
-sys_exec(void)
+// Fetch the nth word-sized system call argument as a
+// null-terminated array of at most max string pointers,
+// and set argv to the strings.
+static int
+argargv(int n, char **argv, int max)
 {
-  char *path, *argv[20];
   int i;
   uint uargv, uarg;
 
-  if(argstr(0, &path) < 0 || argint(1, (int*)&uargv) < 0)
+  if(argint(n, (int*)&uargv) < 0)
     return -1;
-  memset(argv, 0, sizeof(argv));
+  memset(argv, 0, max*sizeof(argv[0]));
   for(i=0;; i++){
-    if(i >= NELEM(argv))
+    if(i >= max)
       return -1;
     if(fetchint(cp, uargv+4*i, (int*)&uarg) < 0)
       return -1;
@@ -366,9 +507,52 @@ sys_exec(void)
     if(fetchstr(cp, uarg, &argv[i]) < 0)
       return -1;
   }
+  return 0;
+}
+
+int
+sys_exec(void)
+{
+  char *path, *argv[20];
+
+  if(argstr(0, &path) < 0 || argargv(1, argv, NELEM(argv)) < 0)
+    return -1;
   return exec(path, argv);
 }
 
+int
+sys_spawn(void)
+{
+  char *path, *argv[20];
+  int nact;
+  struct spawnact *act;
+
+  if(argstr(0, &path) < 0 || argargv(1, argv, NELEM(argv)) < 0)
+    return -1;
+  if(argint(3, &nact) < 0 || nact < 0 || nact > NSPAWNACT)
+    return -1;
+  if(argptr(2, (void*)&act, nact*sizeof(act[0])) < 0)
+    return -1;
+  return spawn(path, argv, act, nact);
+}
+
+int
+sys_shmcreate(void)
+{
+  int n, fd;
+  struct file *f;
+
+  if(argint(0, &n) < 0 || n < 0)
+    return -1;
+  if(shmalloc(&f, n) < 0)
+    return -1;
+  if((fd = fdalloc(f)) < 0){
+    fileclose(f);
+    return -1;
+  }
+  return fd;
+}
+
 int
 sys_pipe(void)
 {
@@ -376,7 +560,7 @@ sys_pipe(void)
   struct file *rf, *wf;
   int fd0, fd1;
 
-  if(argptr(0, (void*)&fd, 2*sizeof(fd[0])) < 0)
+  if(argwptr(0, (void*)&fd, 2*sizeof(fd[0])) < 0)
     return -1;
   if(pipealloc(&rf, &wf) < 0)
     return -1;
@@ -3,6 +3,7 @@
 #include "param.h"
 #include "mmu.h"
 #include "proc.h"
+#include "meminfo.h"
 
 int
 sys_fork(void)
@@ -13,7 +14,7 @@ sys_fork(void)
   if((np = copyproc(cp)) == 0)
     return -1;
   pid = np->pid;
-  np->state = RUNNABLE;
+  setrunnable(np);
   return pid;
 }
 
@@ -59,6 +60,16 @@ sys_sbrk(void)
   return addr;
 }
 
+int
+sys_munmap(void)
+{
+  int addr, n;
+
+  if(argint(0, &addr) < 0 || argint(1, &n) < 0 || n < 0)
+    return -1;
+  return munmap(addr, n);
+}
+
 int
 sys_sleep(void)
 {
@@ -78,3 +89,28 @@ sys_sleep(void)
   release(&tickslock);
   return 0;
 }
+
+// Report memory use: fill in *mi, and up to n entries of pm
+// for the processes using memory.
+// Returns the number of entries of pm filled in.
+int
+sys_meminfo(void)
+{
+  int n, m, pid;
+  struct meminfo *umi, mi;
+  struct procmem *upm, pm;
+
+  if(argint(2, &n) < 0 || n < 0 || n > NPROC)
+    return -1;
+  if(argwptr(0, (char**)&umi, sizeof(*umi)) < 0 ||
+     argwptr(1, (char**)&upm, n*sizeof(*upm)) < 0)
+    return -1;
+  // Gather into kernel memory first, since touching
+  // user memory may fault and sleep.
+  kmeminfo(&mi);
+  memmove(umi, &mi, sizeof(mi));
+  pid = 0;
+  for(m = 0; m < n && (pid = procmem(pid, &pm)) != 0; m++)
+    memmove(&upm[m], &pm, sizeof(pm));
+  return m;
+}
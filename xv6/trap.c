@@ -34,6 +34,8 @@ idtinit(void)
 void
 trap(struct trapframe *tf)
 {
+  uint va;
+
   if(tf->trapno == T_SYSCALL){
     if(cp->killed)
       exit();
@@ -68,11 +70,24 @@ trap(struct trapframe *tf)
     lapic_eoi();
     break;
     
+  case T_PGFLT:
+    // Writes to copy-on-write pages, and pages not yet
+    // paged in, from user space.  The kernel pages in and
+    // copies user memory before using it (see prefault),
+    // where it can wait for memory; cowfault here only
+    // catches kernel writes that were not prepared for.
+    va = rcr2() - USERBASE;
+    if(cp && cowfault(cp->pgdir, va) == 0)
+      break;
+    if(cp && (tf->cs&3) == DPL_USER && va < cp->sz &&
+       pagein(cp->pgdir, va, cp->exe, cp->seg, cp->nseg) == 0)
+      break;
+    // fall through
   default:
     if(cp == 0 || (tf->cs&3) == 0){
       // In kernel, it must be our mistake.
-      cprintf("unexpected trap %d from cpu %d eip %x\n",
-              tf->trapno, cpu(), tf->eip);
+      cprintf("unexpected trap %d from cpu %d eip %x cr2 %x\n",
+              tf->trapno, cpu(), tf->eip, rcr2());
       panic("trap");
     }
     // In user space, assume process misbehaved.
@@ -1,3 +1,5 @@
 typedef unsigned int   uint;
 typedef unsigned short ushort;
 typedef unsigned char  uchar;
+typedef uint pde_t;
+typedef uint pte_t;
@@ -0,0 +1,6 @@
+// Scatter/gather vector for readv and writev.
+// Both the kernel and user programs use this header file.
+struct iovec {
+  void *base;  // Start of buffer
+  int len;     // Length of buffer (bytes)
+};
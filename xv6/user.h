@@ -1,4 +1,8 @@
 struct stat;
+struct iovec;
+struct meminfo;
+struct spawnact;
+struct procmem;
 
 // system calls
 int fork(void);
@@ -21,6 +25,18 @@ int dup(int);
 int getpid();
 char* sbrk(int);
 int sleep(int);
+int pread(int, void*, int, uint);
+int pwrite(int, void*, int, uint);
+int readv(int, struct iovec*, int);
+int writev(int, struct iovec*, int);
+int getdents(int, void*, int, int);
+int copy_file_range(int, int, int);
+int splice(int, int, int);
+int spawn(char*, char**, struct spawnact*, int);
+char* mmap(int, int, int);
+int munmap(void*, int);
+int shmcreate(int);
+int meminfo(struct meminfo*, struct procmem*, int);
 
 // ulib.c
 int stat(char*, struct stat*);
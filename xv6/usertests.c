@@ -3,6 +3,10 @@
 #include "user.h"
 #include "fs.h"
 #include "fcntl.h"
+#include "uio.h"
+#include "param.h"
+#include "meminfo.h"
+#include "spawn.h"
 
 char buf[2048];
 char name[3];
@@ -187,6 +191,92 @@ void dirtest(void)
   printf(stdout, "mkdir test\n");
 }
 
+// Spawn echo with its output redirected into a pipe.
+// Returns the read end of the pipe.
+int
+spawnecho(char *test)
+{
+  int fds[2];
+  struct spawnact act[3];
+
+  if(pipe(fds) != 0){
+    printf(stdout, "%s: pipe failed\n", test);
+    exit();
+  }
+  act[0].op = SPAWN_DUP;
+  act[0].fd = 1;
+  act[0].src = fds[1];
+  act[1].op = SPAWN_CLOSE;
+  act[1].fd = fds[0];
+  act[2].op = SPAWN_CLOSE;
+  act[2].fd = fds[1];
+  if(spawn("echo", echo_args, act, 3) < 0){
+    printf(stdout, "%s: spawn echo failed\n", test);
+    exit();
+  }
+  close(fds[1]);
+  return fds[0];
+}
+
+// Read what a spawnecho child wrote to fd, wait
+// for a child, and check the output.
+void
+readecho(int fd, char *test)
+{
+  int n, m;
+
+  for(n = 0; (m = read(fd, buf + n, sizeof(buf) - 1 - n)) > 0; n += m)
+    ;
+  buf[n] = 0;
+  close(fd);
+  wait();
+  if(strcmp(buf, "ALL TESTS PASSED\n") != 0){
+    printf(stdout, "%s: wrong output\n", test);
+    exit();
+  }
+}
+
+// spawn a child with its output redirected into a pipe.
+void
+spawntest(void)
+{
+  printf(stdout, "spawn test\n");
+  readecho(spawnecho("spawn"), "spawn");
+  if(spawn("nonexistent", echo_args, 0, 0) >= 0){
+    printf(stdout, "spawn nonexistent succeeded\n");
+    exit();
+  }
+  printf(stdout, "spawn ok\n");
+}
+
+// Execs after the first map echo's pages from the text cache,
+// so running several copies at once adds no pages to it.
+void
+texttest(void)
+{
+  int i, fd[4];
+  struct stat st;
+  struct meminfo m0, m1;
+
+  printf(stdout, "text test\n");
+  if(stat("echo", &st) < 0){
+    printf(stdout, "text: cannot stat echo\n");
+    exit();
+  }
+  readecho(spawnecho("text"), "text");
+  meminfo(&m0, 0, 0);
+  for(i = 0; i < 4; i++)
+    fd[i] = spawnecho("text");
+  for(i = 0; i < 4; i++)
+    readecho(fd[i], "text");
+  meminfo(&m1, 0, 0);
+  if(m1.nused[KM_PCACHE] >= m0.nused[KM_PCACHE] + (st.size + PAGE - 1) / PAGE){
+    printf(stdout, "text: echo's pages not shared\n");
+    exit();
+  }
+  printf(stdout, "text ok\n");
+}
+
 void
 exectest(void)
 {
@@ -249,6 +339,60 @@ pipe1(void)
   printf(1, "pipe1 ok\n");
 }
 
+// splice a file into a pipe in one process and out of
+// the pipe into another file in a second process.
+void
+splicetest(void)
+{
+  int fds[2], fd, pid, i, n;
+
+  printf(1, "splice test\n");
+  fd = open("splice0", O_CREATE|O_RDWR);
+  for(i = 0; i < 2000; i++)
+    buf[i] = i % 253;
+  if(write(fd, buf, 2000) != 2000){
+    printf(1, "splice: write failed\n");
+    exit();
+  }
+  close(fd);
+
+  if(pipe(fds) != 0){
+    printf(1, "splice: pipe failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid == 0){
+    close(fds[0]);
+    fd = open("splice0", 0);
+    if(splice(fd, fds[1], 5000) != 2000)
+      printf(1, "splice: file to pipe failed\n");
+    exit();
+  }
+  close(fds[1]);
+  fd = open("splice1", O_CREATE|O_RDWR);
+  if(splice(fds[0], fd, 5000) != 2000){
+    printf(1, "splice: pipe to file failed\n");
+    exit();
+  }
+  close(fds[0]);
+  close(fd);
+  wait();
+
+  fd = open("splice1", 0);
+  memset(buf, 0, 2000);
+  n = read(fd, buf, sizeof(buf));
+  close(fd);
+  for(i = 0; i < 2000; i++){
+    if(n != 2000 || (buf[i] & 0xff) != i % 253){
+      printf(1, "splice: wrong data\n");
+      exit();
+    }
+  }
+  unlink("splice0");
+  unlink("splice1");
+  printf(1, "splice ok\n");
+}
+
 // meant to be run w/ at most two CPUs
 void
 preempt(void)
@@ -400,6 +544,502 @@ sharedfd(void)
     printf(1, "sharedfd oops %d %d\n", nc, np);
 }
 
+// fork shares memory copy-on-write: writes by the child,
+// including those the kernel makes for it, stay private.
+void
+cowtest(void)
+{
+  int fds[2], i, n, pid;
+  char *p;
+
+  printf(1, "cow test\n");
+  n = 3*4096 + 10;
+  p = sbrk(n);
+  for(i = 0; i < sizeof(buf); i++)
+    buf[i] = 'a';
+  for(i = 0; i < n; i++)
+    p[i] = 'b';
+  if(pipe(fds) != 0){
+    printf(1, "cow: pipe failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid == 0){
+    close(fds[1]);
+    for(i = 0; i < sizeof(buf); i++)
+      buf[i] = 'c';
+    if(read(fds[0], p + 4090, 10) != 10 || p[4090] != 'd' || p[4099] != 'd'){
+      printf(1, "cow: read into shared page failed\n");
+      exit();
+    }
+    exit();
+  }
+  close(fds[0]);
+  for(i = 0; i < 10; i++)
+    buf[i] = 'd';
+  write(fds[1], buf, 10);
+  close(fds[1]);
+  wait();
+  for(i = 10; i < sizeof(buf); i++){
+    if(buf[i] != 'a'){
+      printf(1, "cow: child write seen by parent\n");
+      exit();
+    }
+  }
+  for(i = 0; i < n; i++){
+    if(p[i] != 'b'){
+      printf(1, "cow: child read seen by parent\n");
+      exit();
+    }
+  }
+  sbrk(-n);
+  printf(1, "cow ok\n");
+}
+
+// bss is paged in on demand, zero-filled, including
+// when the kernel is the first to touch it.
+char bss[5*4096];
+
+void
+bsstest(void)
+{
+  int fd, i;
+
+  printf(1, "bss test\n");
+  fd = open("README", 0);
+  if(fd < 0 || read(fd, bss + 3*4096 - 10, 100) != 100){
+    printf(1, "bss: read into bss failed\n");
+    exit();
+  }
+  close(fd);
+  for(i = 0; i < sizeof(bss); i++){
+    if(i == 3*4096 - 10)
+      i += 100;
+    if(bss[i] != 0){
+      printf(1, "bss: not zero\n");
+      exit();
+    }
+  }
+  printf(1, "bss ok\n");
+}
+
+// sbrk grows and shrinks memory in place.
+void
+sbrktest(void)
+{
+  int i;
+  char *a, *p, *start;
+
+  printf(1, "sbrk test\n");
+  start = sbrk(0);
+  for(i = 0; i < 100; i++){
+    a = sbrk(1001);
+    if(a != start + i*1001){
+      printf(1, "sbrk: moved to %x\n", a);
+      exit();
+    }
+    *a = i;
+  }
+  for(i = 0; i < 100; i++){
+    if(start[i*1001] != (char)i){
+      printf(1, "sbrk: lost data\n");
+      exit();
+    }
+  }
+  p = sbrk(-100*1001);
+  if(p != start + 100*1001 || sbrk(0) != start){
+    printf(1, "sbrk: shrink failed\n");
+    exit();
+  }
+  printf(1, "sbrk ok\n");
+}
+
+// mmap maps the page cache copy-on-write, so the mapping
+// sees the file's contents but writes to it stay private.
+void
+mmaptest(void)
+{
+  int fd, i;
+  char *p;
+
+  printf(1, "mmap test\n");
+  fd = open("mmapfile", O_CREATE|O_RDWR);
+  for(i = 0; i < 5; i++){
+    memset(buf, 'a' + i, sizeof(buf));
+    if(write(fd, buf, sizeof(buf)) != sizeof(buf)){
+      printf(1, "mmap: write failed\n");
+      exit();
+    }
+  }
+  p = mmap(fd, 0, 5*sizeof(buf));
+  if(p == (char*)-1){
+    printf(1, "mmap failed\n");
+    exit();
+  }
+  for(i = 0; i < 5*sizeof(buf); i++){
+    if(p[i] != 'a' + i/sizeof(buf)){
+      printf(1, "mmap: wrong data\n");
+      exit();
+    }
+  }
+  p[0] = 'x';
+  if(pread(fd, buf, 1, 0) != 1 || buf[0] != 'a'){
+    printf(1, "mmap: write reached the file\n");
+    exit();
+  }
+  if(munmap(p, 5*sizeof(buf)) < 0){
+    printf(1, "munmap failed\n");
+    exit();
+  }
+
+  // A write to the file drops the old page from the cache.
+  if(pwrite(fd, "z", 1, 4096) != 1){
+    printf(1, "mmap: pwrite failed\n");
+    exit();
+  }
+  p = mmap(fd, 4096, 4096);
+  if(p == (char*)-1 || p[0] != 'z' || p[1] != 'c'){
+    printf(1, "mmap: stale page\n");
+    exit();
+  }
+  munmap(p, 4096);
+  if(mmap(fd, 100, 4096) != (char*)-1){
+    printf(1, "mmap: unaligned offset succeeded\n");
+    exit();
+  }
+  close(fd);
+  unlink("mmapfile");
+  printf(1, "mmap ok\n");
+}
+
+// A sleeping child's memory survives being swapped out
+// while its parent uses up all of memory.
+void
+swaptest(void)
+{
+  int fds[2], pid, i, n;
+  char *p;
+
+  printf(1, "swap test\n");
+  if(pipe(fds) != 0){
+    printf(1, "swap: pipe failed\n");
+    exit();
+  }
+  pid = fork();
+  if(pid < 0){
+    printf(1, "swap: fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    p = sbrk(32*4096);
+    for(i = 0; i < 32*4096; i++)
+      p[i] = i % 251;
+    write(fds[1], "x", 1);
+    sleep(100);
+    for(i = 0; i < 32*4096; i++){
+      if(p[i] != (char)(i % 251)){
+        printf(1, "swap: lost data\n");
+        exit();
+      }
+    }
+    exit();
+  }
+  close(fds[1]);
+  if(read(fds[0], buf, 1) != 1){
+    printf(1, "swap: child failed\n");
+    exit();
+  }
+  close(fds[0]);
+  for(n = 0; sbrk(16*4096) != (char*)-1; n++)
+    ;
+  sbrk(-n*16*4096);
+  wait();
+  printf(1, "swap ok\n");
+}
+
+// Writes by a child to shared memory are seen by its parent.
+void
+shmtest(void)
+{
+  int fd, pid, i;
+  char *p;
+
+  printf(1, "shm test\n");
+  fd = shmcreate(2*4096);
+  if(fd < 0){
+    printf(1, "shmcreate failed\n");
+    exit();
+  }
+  p = mmap(fd, 0, 2*4096);
+  if(p == (char*)-1){
+    printf(1, "shm: mmap failed\n");
+    exit();
+  }
+  if(read(fd, buf, 1) >= 0){
+    printf(1, "shm: read succeeded\n");
+    exit();
+  }
+  pid = fork();
+  if(pid < 0){
+    printf(1, "shm: fork failed\n");
+    exit();
+  }
+  if(pid == 0){
+    for(i = 0; i < 2*4096; i++)
+      p[i] = i;
+    exit();
+  }
+  wait();
+  for(i = 0; i < 2*4096; i++){
+    if(p[i] != (char)i){
+      printf(1, "shm: child's write not seen\n");
+      exit();
+    }
+  }
+  strcpy(p, "echo");
+  if(open(p, 0) >= 0){
+    printf(1, "shm: open of a path in shared memory succeeded\n");
+    exit();
+  }
+  munmap(p, 2*4096);
+  close(fd);
+  printf(1, "shm ok\n");
+}
+
+struct procmem pm[NPROC];
+
+// Find this process among the n entries of pm.
+struct procmem*
+findmem(int n)
+{
+  int i;
+
+  for(i = 0; i < n; i++)
+    if(pm[i].pid == getpid())
+      return &pm[i];
+  return 0;
+}
+
+// meminfo accounts for pages as they are allocated.
+void
+meminfotest(void)
+{
+  struct meminfo m0, m1;
+  struct procmem *me;
+  int i, n, rss;
+  uint used;
+  char *p;
+
+  printf(1, "meminfo test\n");
+  n = meminfo(&m0, pm, NPROC);
+  if(n <= 0 || (me = findmem(n)) == 0){
+    printf(1, "meminfo: not listed\n");
+    exit();
+  }
+  rss = me->rss;
+  used = 0;
+  for(i = 0; i < NKM; i++)
+    used += m0.nused[i];
+  if(m0.nused[KM_KSTACK] < n || used + m0.nfree > m0.npages ||
+     m0.largest > m0.nfree){
+    printf(1, "meminfo: totals do not add up\n");
+    exit();
+  }
+
+  p = sbrk(8*4096);
+  for(i = 0; i < 8*4096; i += 4096)
+    p[i] = 1;
+  n = meminfo(&m1, pm, NPROC);
+  if((me = findmem(n)) == 0 || me->rss < rss + 8 ||
+     m1.nused[KM_USER] < m0.nused[KM_USER] + 8){
+    printf(1, "meminfo: new pages not counted\n");
+    exit();
+  }
+  sbrk(-8*4096);
+  printf(1, "meminfo ok\n");
+}
+
+// two processes pwrite disjoint records through the same
+// file descriptor; neither should move the shared offset.
+// then check the records with pread and readv/writev.
+void
+preadtest(void)
+{
+  int fd, pid, i, off;
+  char rec[10], rec1[10];
+  struct iovec iov[2];
+
+  printf(1, "pread test\n");
+  unlink("preadf");
+  fd = open("preadf", O_CREATE|O_RDWR);
+  if(fd < 0){
+    printf(1, "pread: cannot open preadf\n");
+    exit();
+  }
+  memset(buf, 0, 2000);
+  if(write(fd, buf, 2000) != 2000 || pwrite(fd, buf, 1, 2001) >= 0){
+    printf(1, "pread: pwrite past end of file\n");
+    exit();
+  }
+  close(fd);
+  fd = open("preadf", O_RDWR);
+  pid = fork();
+  memset(rec, pid==0?'c':'p', sizeof(rec));
+  off = pid==0 ? 0 : sizeof(rec);
+  for(i = 0; i < 100; i++){
+    if(pwrite(fd, rec, sizeof(rec), off + 2*sizeof(rec)*i) != sizeof(rec)){
+      printf(1, "pread: pwrite failed\n");
+      exit();
+    }
+  }
+  if(pid == 0)
+    exit();
+  wait();
+
+  if(read(fd, rec, sizeof(rec)) != sizeof(rec) || rec[0] != 'c'){
+    printf(1, "pread: pwrite moved offset\n");
+    exit();
+  }
+  if(pread(fd, rec, sizeof(rec), 2*sizeof(rec)*50 + sizeof(rec)) != sizeof(rec) ||
+     rec[0] != 'p' || rec[9] != 'p'){
+    printf(1, "pread: wrong data\n");
+    exit();
+  }
+
+  iov[0].base = rec;
+  iov[0].len = sizeof(rec);
+  iov[1].base = rec1;
+  iov[1].len = sizeof(rec1);
+  if(readv(fd, iov, 2) != 2*sizeof(rec) || rec[0] != 'p' || rec1[0] != 'c'){
+    printf(1, "pread: readv wrong data\n");
+    exit();
+  }
+  memset(rec, 'x', sizeof(rec));
+  memset(rec1, 'y', sizeof(rec1));
+  if(writev(fd, iov, 2) != 2*sizeof(rec)){
+    printf(1, "pread: writev failed\n");
+    exit();
+  }
+  if(pread(fd, rec, sizeof(rec), 4*sizeof(rec)) != sizeof(rec) || rec[0] != 'y'){
+    printf(1, "pread: writev wrong data\n");
+    exit();
+  }
+  close(fd);
+  unlink("preadf");
+  printf(1, "pread test ok\n");
+}
+
+// copy_file_range shares whole blocks between the files;
+// writing either copy must not show through in the other.
+void
+clonetest(void)
+{
+  int fd0, fd1, i, n;
+
+  printf(1, "clone test\n");
+  unlink("clone0");
+  unlink("clone1");
+  fd0 = open("clone0", O_CREATE|O_RDWR);
+  for(i = 0; i < 3*512+100; i++)
+    buf[i] = i % 251;
+  if(write(fd0, buf, 3*512+100) != 3*512+100){
+    printf(1, "clone: write failed\n");
+    exit();
+  }
+  close(fd0);
+
+  fd0 = open("clone0", O_RDWR);
+  fd1 = open("clone1", O_CREATE|O_RDWR);
+  if(copy_file_range(fd0, fd1, 10) != 10 ||
+     copy_file_range(fd0, fd1, 4096) != 3*512+100-10){
+    printf(1, "clone: copy_file_range failed\n");
+    exit();
+  }
+  close(fd1);
+
+  // overwrite the original; the copy keeps the old data.
+  memset(buf, 'x', 3*512+100);
+  if(pwrite(fd0, buf, 3*512+100, 0) != 3*512+100){
+    printf(1, "clone: pwrite failed\n");
+    exit();
+  }
+  if(pread(fd0, buf, 1, 3*512+99) != 1 || buf[0] != 'x'){
+    printf(1, "clone: original not written\n");
+    exit();
+  }
+  close(fd0);
+
+  fd1 = open("clone1", 0);
+  n = read(fd1, buf, sizeof(buf));
+  close(fd1);
+  if(n != 3*512+100){
+    printf(1, "clone: copy has %d bytes\n", n);
+    exit();
+  }
+  for(i = 0; i < n; i++){
+    if((buf[i] & 0xff) != i % 251){
+      printf(1, "clone: wrong data at %d\n", i);
+      exit();
+    }
+  }
+  if(unlink("clone0") < 0 || unlink("clone1") < 0){
+    printf(1, "clone: unlink failed\n");
+    exit();
+  }
+  printf(1, "clone test ok\n");
+}
+
+// a shared block replaces what readers of the copy had
+// in the page cache, including zeros past its old end.
+void
+clonecache(void)
+{
+  int fd0, fd1, i;
+
+  printf(1, "clone cache test\n");
+  unlink("clone0");
+  unlink("clone1");
+  fd0 = open("clone0", O_CREATE|O_RDWR);
+  for(i = 0; i < 2*512; i++)
+    buf[i] = i % 251;
+  if(write(fd0, buf, 2*512) != 2*512){
+    printf(1, "clone cache: write failed\n");
+    exit();
+  }
+  close(fd0);
+
+  // read the copy first, so that its page is cached.
+  fd1 = open("clone1", O_CREATE|O_RDWR);
+  memset(buf, 'y', 512);
+  if(write(fd1, buf, 512) != 512 || pread(fd1, buf, 2*512, 0) != 512){
+    printf(1, "clone cache: read failed\n");
+    exit();
+  }
+  close(fd1);
+
+  fd0 = open("clone0", 0);
+  fd1 = open("clone1", O_RDWR);
+  if(copy_file_range(fd0, fd1, 2*512) != 2*512){
+    printf(1, "clone cache: copy_file_range failed\n");
+    exit();
+  }
+  close(fd0);
+  if(pread(fd1, buf, sizeof(buf), 0) != 2*512){
+    printf(1, "clone cache: copy has wrong size\n");
+    exit();
+  }
+  close(fd1);
+  for(i = 0; i < 2*512; i++){
+    if((buf[i] & 0xff) != i % 251){
+      printf(1, "clone cache: stale data at %d\n", i);
+      exit();
+    }
+  }
+  unlink("clone0");
+  unlink("clone1");
+  printf(1, "clone cache ok\n");
+}
+
 // two processes write two different files at the same
 // time, to test block allocation.
 void
@@ -737,6 +1377,68 @@ concreate(void)
   printf(1, "concreate ok\n");
 }
 
+// getdents should return every entry of a directory,
+// in batches, with stat data matching fstat.
+void
+getdentstest(void)
+{
+  int i, fd, n, nent, nstat;
+  char name[3];
+  struct dirent de[8];
+  struct dirstat ds[8];
+  struct stat st;
+
+  printf(1, "getdents test\n");
+  if(mkdir("gd") < 0 || chdir("gd") < 0){
+    printf(1, "getdents mkdir failed\n");
+    exit();
+  }
+  name[0] = 'g';
+  name[2] = '\0';
+  for(i = 0; i < 20; i++){
+    name[1] = 'a' + i;
+    fd = open(name, O_CREATE|O_RDWR);
+    write(fd, buf, i);
+    close(fd);
+  }
+
+  fd = open(".", 0);
+  nent = 0;
+  while((n = getdents(fd, de, sizeof(de), 0)) > 0)
+    nent += n / sizeof(de[0]);
+  close(fd);
+
+  fd = open(".", 0);
+  nstat = 0;
+  while((n = getdents(fd, ds, sizeof(ds), 1)) > 0){
+    for(i = 0; i < n / sizeof(ds[0]); i++){
+      if(ds[i].name[0] != 'g')
+        continue;
+      if(stat(ds[i].name, &st) < 0 || st.ino != ds[i].inum ||
+         ds[i].st.ino != ds[i].inum || ds[i].st.size != ds[i].name[1] - 'a'){
+        printf(1, "getdents wrong stat for %s\n", ds[i].name);
+        exit();
+      }
+      nstat++;
+    }
+  }
+  close(fd);
+  if(nent != 22 || nstat != 20){
+    printf(1, "getdents saw %d %d entries\n", nent, nstat);
+    exit();
+  }
+
+  for(i = 0; i < 20; i++){
+    name[1] = 'a' + i;
+    unlink(name);
+  }
+  if(chdir("..") < 0 || unlink("gd") < 0){
+    printf(1, "getdents cleanup failed\n");
+    exit();
+  }
+  printf(1, "getdents ok\n");
+}
+
 // directory that uses indirect blocks
 void
 bigdir(void)
@@ -1166,7 +1868,7 @@ iref(void)
 
   printf(1, "empty file name\n");
 
-  // the 50 is NINODE
+  // 50 is more than the old fixed inode table held
   for(i = 0; i < 50 + 1; i++){
     if(mkdir("irefd") != 0){
       printf(1, "mkdir irefd failed\n");
@@ -1247,7 +1949,15 @@ main(int argc, char *argv[])
   createtest();
 
   mem();
+  cowtest();
+  bsstest();
+  sbrktest();
+  mmaptest();
+  shmtest();
+  meminfotest();
+  swaptest();
   pipe1();
+  splicetest();
   preempt();
   exitwait();
 
@@ -1261,9 +1971,15 @@ main(int argc, char *argv[])
   createdelete();
   twofiles();
   sharedfd();
+  preadtest();
+  clonetest();
+  clonecache();
   dirfile();
   iref();
+  getdentstest();
   forktest();
+  spawntest();
+  texttest();
   bigdir(); // slow
 
   exectest();
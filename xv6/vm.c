@@ -0,0 +1,519 @@
+// Per-process page tables.
+//
+// The kernel runs with paging on but still addresses physical
+// memory directly: every page directory maps the whole linear
+// address space one-to-one, with 4MB pages, except for the
+// USERMAX bytes at USERBASE.  There each process's own page
+// tables map its memory, so user address va is linear address
+// USERBASE+va; the user segments set up by setupsegs start at
+// USERBASE.  The kernel reaches the memory of the current
+// process at the same addresses, and that of other processes
+// through their page tables (uva2ka, copyout).
+//
+// fork shares all of the parent's pages with the child,
+// read-only in both and marked PTE_COW.  The first write to
+// such a page faults, and cowfault gives the writer a copy,
+// or the page itself if nobody else is still using it.
+// CR0_WP would make kernel writes to user memory fault the
+// same way, but the kernel breaks copy-on-write before writing
+// to user memory (see cowbreak), since it cannot wait for memory
+// in the middle of a write.
+//
+// exec maps almost nothing: pages of a program are read
+// from its file, or zero-filled, by pagein when first
+// touched.  Page faults in user space call it directly;
+// the kernel faults in the user memory named in system
+// call arguments before using it (see prefault), since
+// reading the file may sleep.
+//
+// Pages that hold program text or data are kept in the page
+// cache (pcache.c), keyed by program file and address, and
+// mapped copy-on-write into every process that runs the
+// program, so repeated execs of sh or ls share one copy.
+// mmap maps file pages from the page cache the same way.
+//
+// The private pages of a sleeping process may be swapped out
+// when memory runs out (see swap.c); their page table entries
+// then hold a swap slot and PTE_SWAP.
+
+#include "types.h"
+#include "defs.h"
+#include "param.h"
+#include "mmu.h"
+#include "x86.h"
+#include "proc.h"
+#include "fs.h"
+#include "fsvar.h"
+#include "meminfo.h"
+
+#define min(a, b) ((a) < (b) ? (a) : (b))
+
+pde_t *kpgdir;  // for use when no process is running
+
+// Build kpgdir, the kernel part of every page directory.
+void
+vminit(void)
+{
+  uint i;
+
+  if((kpgdir = (pde_t*)kalloc(PAGE, KM_PGTAB)) == 0)
+    panic("vminit");
+  for(i = 0; i < NPDENTRIES; i++)
+    kpgdir[i] = (i << PDXSHIFT) | PTE_P | PTE_W | PTE_PS;
+  for(i = PDX(USERBASE); i < PDX(USERBASE+USERMAX); i++)
+    kpgdir[i] = 0;
+}
+
+// Turn on paging on this CPU, with kpgdir loaded.
+void
+vmenable(void)
+{
+  lcr4(rcr4() | CR4_PSE);
+  lcr3((uint)kpgdir);
+  lcr0(rcr0() | CR0_PG | CR0_WP);
+}
+
+// Return the address of the PTE for user address va in pgdir.
+// If there is no page table for it and alloc is set,
+// allocate one; otherwise return 0.
+static pte_t*
+walkpgdir(pde_t *pgdir, uint va, int alloc)
+{
+  pde_t *pde;
+  pte_t *pgtab;
+
+  pde = &pgdir[PDX(USERBASE + va)];
+  if(*pde & PTE_P)
+    pgtab = (pte_t*)PTE_ADDR(*pde);
+  else {
+    if(!alloc || (pgtab = (pte_t*)kzalloc(KM_PGTAB)) == 0)
+      return 0;
+    *pde = (uint)pgtab | PTE_P | PTE_W | PTE_U;
+  }
+  return &pgtab[PTX(USERBASE + va)];
+}
+
+// Reload cr3 if pgdir is in use on this CPU,
+// to flush stale translations from the TLB.
+static void
+flushtlb(pde_t *pgdir)
+{
+  if(rcr3() == (uint)pgdir)
+    lcr3((uint)pgdir);
+}
+
+// Return a new page directory with the kernel
+// mappings and no user memory, or 0.
+pde_t*
+setupkvm(void)
+{
+  pde_t *pgdir;
+
+  if((pgdir = (pde_t*)kalloc(PAGE, KM_PGTAB)) == 0)
+    return 0;
+  memmove(pgdir, kpgdir, PAGE);
+  return pgdir;
+}
+
+// Allocate a zeroed page of user memory for kind (KM_USER or
+// KM_PCACHE), swapping out a sleeping process to make room if
+// memory has run out.  May sleep.
+static char*
+uvmpage(int kind)
+{
+  char *mem;
+
+  while((mem = kzalloc(kind)) == 0)
+    if(swapout() == 0)
+      return 0;
+  return mem;
+}
+
+// Free the user page, or swap slot, of page table entry pte.
+static void
+freepte(pte_t *pte)
+{
+  if(*pte & PTE_P)
+    kfree((char*)PTE_ADDR(*pte), PAGE);
+  else if(*pte & PTE_SWAP)
+    swapfree(*pte >> PTXSHIFT);
+  *pte = 0;
+}
+
+// Free the user pages from newsz up to oldsz.
+void
+deallocuvm(pde_t *pgdir, uint oldsz, uint newsz)
+{
+  uint a;
+  pte_t *pte;
+
+  for(a = PGROUNDUP(newsz); a < oldsz; a += PAGE)
+    if((pte = walkpgdir(pgdir, a, 0)) != 0)
+      freepte(pte);
+  flushtlb(pgdir);
+}
+
+// Map zeroed pages to grow user memory from oldsz to newsz.
+// Returns 0, or -1 with nothing allocated if out of memory.
+int
+allocuvm(pde_t *pgdir, uint oldsz, uint newsz)
+{
+  uint a;
+  char *mem;
+  pte_t *pte;
+
+  if(newsz > USERMAX)
+    return -1;
+  for(a = PGROUNDUP(oldsz); a < newsz; a += PAGE){
+    mem = uvmpage(KM_USER);
+    if(mem == 0 || (pte = walkpgdir(pgdir, a, 1)) == 0){
+      if(mem)
+        kfree(mem, PAGE);
+      deallocuvm(pgdir, a, oldsz);
+      return -1;
+    }
+    *pte = (uint)mem | PTE_P | PTE_W | PTE_U;
+  }
+  return 0;
+}
+
+// Free a page directory, its page tables,
+// and the user pages they map.
+void
+freevm(pde_t *pgdir)
+{
+  uint i, j;
+  pte_t *pgtab;
+
+  for(i = PDX(USERBASE); i < PDX(USERBASE+USERMAX); i++){
+    if(!(pgdir[i] & PTE_P))
+      continue;
+    pgtab = (pte_t*)PTE_ADDR(pgdir[i]);
+    for(j = 0; j < NPTENTRIES; j++)
+      freepte(&pgtab[j]);
+    kfree((char*)pgtab, PAGE);
+  }
+  kfree((char*)pgdir, PAGE);
+}
+
+// Return a page directory for a child of the process
+// running on pgdir, sharing the first sz bytes of its
+// memory copy-on-write, or 0.  Shared memory stays
+// writable and shared.
+pde_t*
+copyuvm(pde_t *pgdir, uint sz)
+{
+  uint a;
+  pde_t *d;
+  pte_t *pte, *npte;
+
+  if((d = setupkvm()) == 0)
+    return 0;
+  for(a = 0; a < sz; a += PAGE){
+    // Pages not yet paged in stay that way in the child.
+    if((pte = walkpgdir(pgdir, a, 0)) == 0 || !(*pte & PTE_P))
+      continue;
+    if((npte = walkpgdir(d, a, 1)) == 0){
+      freevm(d);
+      flushtlb(pgdir);
+      return 0;
+    }
+    if((*pte & PTE_W) && !(*pte & PTE_SHARED))
+      *pte = (*pte & ~PTE_W) | PTE_COW;
+    *npte = *pte;
+    kdup((char*)PTE_ADDR(*pte));
+  }
+  flushtlb(pgdir);
+  return d;
+}
+
+// Count the pages among the first sz bytes of pgdir that are
+// in memory.  pgdir may belong to another process, which may
+// be changing it, so the count is only a snapshot.
+int
+countuvm(pde_t *pgdir, uint sz)
+{
+  int n;
+  uint a;
+  pte_t *pte;
+
+  n = 0;
+  for(a = 0; a < sz && a < USERMAX; a += PAGE)
+    if((pte = walkpgdir(pgdir, a, 0)) != 0 && (*pte & PTE_P))
+      n++;
+  return n;
+}
+
+// Make the copy-on-write page at user address va
+// in pgdir writable, copying it if it is still shared.
+// Returns 0, or -1 if va is not such a page or
+// there is no memory for the copy.
+int
+cowfault(pde_t *pgdir, uint va)
+{
+  char *mem, *pa;
+  pte_t *pte;
+
+  if(va >= USERMAX || (pte = walkpgdir(pgdir, va, 0)) == 0)
+    return -1;
+  if((*pte & (PTE_P|PTE_COW)) != (PTE_P|PTE_COW))
+    return -1;
+  pa = (char*)PTE_ADDR(*pte);
+  if(kshared(pa)){
+    if((mem = kalloc(PAGE, KM_USER)) == 0)
+      return -1;
+    memmove(mem, pa, PAGE);
+    kfree(pa, PAGE);
+    pa = mem;
+  }
+  *pte = (uint)pa | PTE_P | PTE_W | PTE_U;
+  flushtlb(pgdir);
+  return 0;
+}
+
+// Make sure user address va in pgdir is not a copy-on-write
+// page, as cowfault does, but if there is no memory for the
+// copy, swap out a sleeping process to make room, as uvmpage
+// does.  The kernel calls this before writing to user memory,
+// since it cannot do that from a page fault.  May sleep.
+// Returns 0, or -1 if memory has run out.
+int
+cowbreak(pde_t *pgdir, uint va)
+{
+  pte_t *pte;
+
+  for(;;){
+    if(va >= USERMAX || (pte = walkpgdir(pgdir, va, 0)) == 0)
+      return 0;
+    if((*pte & (PTE_P|PTE_COW)) != (PTE_P|PTE_COW))
+      return 0;
+    if(cowfault(pgdir, va) == 0)
+      return 0;
+    if(swapout() == 0)
+      return -1;
+  }
+}
+
+// Is user address va in pgdir shared memory, which
+// other processes can write to at any time?
+int
+uvmshared(pde_t *pgdir, uint va)
+{
+  pte_t *pte;
+
+  if(va >= USERMAX || (pte = walkpgdir(pgdir, va, 0)) == 0)
+    return 0;
+  return (*pte & PTE_SHARED) != 0;
+}
+
+// Return the kernel address of user address va in pgdir,
+// or 0 if it is not mapped.
+char*
+uva2ka(pde_t *pgdir, uint va)
+{
+  pte_t *pte;
+
+  if(va >= USERMAX || (pte = walkpgdir(pgdir, va, 0)) == 0)
+    return 0;
+  if(!(*pte & PTE_P))
+    return 0;
+  return (char*)PTE_ADDR(*pte) + va % PAGE;
+}
+
+// Copy len bytes from p to user address va in pgdir,
+// which need not be the current page directory.
+// Returns 0, or -1 if part of the range is not mapped.
+int
+copyout(pde_t *pgdir, uint va, void *p, uint len)
+{
+  uint n;
+  char *ka;
+  pte_t *pte;
+
+  while(len > 0){
+    if(va >= USERMAX || (pte = walkpgdir(pgdir, va, 0)) == 0)
+      return -1;
+    if((*pte & PTE_COW) && cowfault(pgdir, va) < 0)
+      return -1;
+    if((ka = uva2ka(pgdir, va)) == 0)
+      return -1;
+    n = min(len, PAGE - va%PAGE);
+    memmove(ka, p, n);
+    p = (char*)p + n;
+    va += n;
+    len -= n;
+  }
+  return 0;
+}
+
+// Read back the swapped-out page of page table entry pte.
+// Returns 0, or -1 if out of memory.  May sleep.
+static int
+swapinpage(pte_t *pte)
+{
+  char *mem;
+
+  if((mem = kalloc(PAGE, KM_USER)) == 0)
+    return -1;
+  swapread(*pte >> PTXSHIFT, mem);
+  *pte = (uint)mem | PTE_P | PTE_W | PTE_U;
+  return 0;
+}
+
+// Write the private pages among the first sz bytes of pgdir,
+// which no CPU may be using, to swap, and free them.  Shared
+// pages, including those in the page cache, stay.
+// Returns the number of pages swapped out.  May sleep.
+int
+swapoutuvm(pde_t *pgdir, uint sz)
+{
+  int n, slot;
+  uint a;
+  char *pa;
+  pte_t *pte;
+
+  n = 0;
+  for(a = 0; a < sz; a += PAGE){
+    pte = walkpgdir(pgdir, a, 0);
+    if(pte == 0 || !(*pte & PTE_P) || (*pte & PTE_SHARED))
+      continue;
+    pa = (char*)PTE_ADDR(*pte);
+    if(kshared(pa))
+      continue;
+    if((slot = swapwrite(pa)) < 0)
+      break;
+    *pte = (slot << PTXSHIFT) | PTE_SWAP;
+    kfree(pa, PAGE);
+    n++;
+  }
+  return n;
+}
+
+// Read back the swapped-out pages among the first sz bytes
+// of pgdir.  Returns the number read, which falls short
+// if memory runs out.  May sleep.
+int
+swapinuvm(pde_t *pgdir, uint sz)
+{
+  int n;
+  uint a;
+  pte_t *pte;
+
+  n = 0;
+  for(a = 0; a < sz; a += PAGE){
+    pte = walkpgdir(pgdir, a, 0);
+    if(pte == 0 || !(*pte & PTE_SWAP))
+      continue;
+    if(swapinpage(pte) < 0)
+      break;
+    n++;
+  }
+  return n;
+}
+
+// Make sure the page holding user address va in pgdir is
+// present.  A page that the nseg segments in seg of program
+// file ip reach is shared from the page cache, or read in and
+// added to it, and mapped copy-on-write; any other page
+// is a new zeroed one.  ip must not be locked; may sleep.
+// Returns 0, or -1 if out of memory or the file is short.
+int
+pagein(pde_t *pgdir, uint va, struct inode *ip, struct vseg *seg, int nseg)
+{
+  int i;
+  uint a, lo, hi;
+  char *mem;
+  pte_t *pte;
+
+  if(va >= USERMAX || (pte = walkpgdir(pgdir, va, 1)) == 0)
+    return -1;
+  if(*pte & PTE_P)
+    return 0;
+  if(*pte & PTE_SWAP)
+    return swapinpage(pte);
+  a = PGROUNDDOWN(va);
+  for(i = 0; i < nseg; i++)
+    if(seg[i].va < a + PAGE && seg[i].va + seg[i].filesz > a)
+      break;
+  if(i == nseg){
+    if((mem = uvmpage(KM_USER)) == 0)
+      return -1;
+    *pte = (uint)mem | PTE_P | PTE_W | PTE_U;
+    return 0;
+  }
+
+  // Hold ip locked until the page is in the page cache,
+  // so that pcinval from writei cannot miss it.
+  ilock(ip);
+  if((mem = pclookup(ip, PC_IMAGE, a)) == 0){
+    if((mem = uvmpage(KM_PCACHE)) == 0){
+      iunlock(ip);
+      return -1;
+    }
+    for(i = 0; i < nseg; i++){
+      lo = seg[i].va > a ? seg[i].va : a;
+      hi = min(seg[i].va + seg[i].filesz, a + PAGE);
+      if(lo >= hi)
+        continue;
+      if(readi(ip, mem + lo - a, seg[i].off + lo - seg[i].va, hi - lo) != hi - lo){
+        iunlock(ip);
+        kfree(mem, PAGE);
+        return -1;
+      }
+    }
+    pcinsert(ip, PC_IMAGE, a, mem);
+  }
+  iunlock(ip);
+  if(*pte & PTE_P){  // paged in while we slept
+    kfree(mem, PAGE);
+    return 0;
+  }
+  *pte = (uint)mem | PTE_P | PTE_U | PTE_COW;
+  return 0;
+}
+
+// Map the len bytes of file ip at page-aligned offset off
+// at page-aligned user address va in pgdir, sharing pages
+// with the page cache, copy-on-write.  ip must be locked.
+// Returns 0, or -1 with nothing mapped.
+int
+mapfile(pde_t *pgdir, uint va, struct inode *ip, uint off, uint len)
+{
+  uint a;
+  char *pa;
+  pte_t *pte;
+
+  if(va + len < va || va + len > USERMAX)
+    return -1;
+  for(a = 0; a < len; a += PAGE){
+    if((pte = walkpgdir(pgdir, va + a, 1)) == 0 ||
+       (pa = ipage(ip, off + a)) == 0){
+      deallocuvm(pgdir, va + a, va);
+      return -1;
+    }
+    *pte = (uint)pa | PTE_P | PTE_U | PTE_COW;
+  }
+  return 0;
+}
+
+// Map the n pages in page at page-aligned user address va
+// in pgdir, writable and shared (see shm.c).
+// Returns 0, or -1 with nothing mapped.
+int
+mapshared(pde_t *pgdir, uint va, char **page, int n)
+{
+  int i;
+  pte_t *pte;
+
+  if(va + n*PAGE < va || va + n*PAGE > USERMAX)
+    return -1;
+  for(i = 0; i < n; i++){
+    if((pte = walkpgdir(pgdir, va + i*PAGE, 1)) == 0){
+      deallocuvm(pgdir, va + i*PAGE, va);
+      return -1;
+    }
+    kdup(page[i]);
+    *pte = (uint)page[i] | PTE_P | PTE_W | PTE_U | PTE_SHARED;
+  }
+  return 0;
+}
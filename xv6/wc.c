@@ -1,30 +1,50 @@
 #include "types.h"
 #include "stat.h"
 #include "user.h"
+#include "fs.h"
 
 char buf[512];
+int l, w, c, inword;
+
+void
+count(char *p, int n)
+{
+  int i;
+
+  for(i=0; i<n; i++){
+    c++;
+    if(p[i] == '\n')
+      l++;
+    if(strchr(" \r\t\n\v", p[i]))
+      inword = 0;
+    else if(!inword){
+      w++;
+      inword = 1;
+    }
+  }
+}
 
 void
 wc(int fd, char *name)
 {
-  int i, n;
-  int l, w, c, inword;
+  int n;
+  char *p;
+  struct stat st;
 
   l = w = c = 0;
   inword = 0;
-  while((n = read(fd, buf, sizeof(buf))) > 0){
-    for(i=0; i<n; i++){
-      c++;
-      if(buf[i] == '\n')
-        l++;
-      if(strchr(" \r\t\n\v", buf[i]))
-        inword = 0;
-      else if(!inword){
-        w++;
-        inword = 1;
-      }
-    }
+
+  // Scan files in place in the page cache, without copying.
+  if(fstat(fd, &st) >= 0 && st.type == T_FILE && st.size > 0 &&
+     (p = mmap(fd, 0, st.size)) != (char*)-1){
+    count(p, st.size);
+    munmap(p, st.size);
+    printf(1, "%d %d %d %s\n", l, w, c, name);
+    return;
   }
+
+  while((n = read(fd, buf, sizeof(buf))) > 0)
+    count(buf, n);
   if(n < 0){
     printf(1, "wc: read error\n");
     exit();